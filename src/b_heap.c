@@ -24,22 +24,31 @@ typedef struct {
 
 #define BHEAP_DEFAULT_CAPACITY 1024
 
-BHeap *b_heap_new(BHeapNodeCompareFunc cmp)
+BHeap *b_heap_new_capacity(BHeapNodeCompareFunc cmp,
+                           BHeapNodeFreeFunc node_free, size_t capacity)
 {
     BHeap *self = malloc(sizeof(*self));
     self->size = 0;
-    self->capacity = BHEAP_DEFAULT_CAPACITY;
+    self->capacity = capacity > 0 ? capacity : 1;
     self->data = malloc(sizeof(*self->data) * self->capacity);
     self->compare_nodes = cmp;
-    self->free_node = free;
+    self->free_node = node_free;
     return self;
 }
 
 BHeap *b_heap_new_full(BHeapNodeCompareFunc cmp, BHeapNodeFreeFunc node_free)
 {
-    BHeap *self = b_heap_new(cmp);
-    self->free_node = node_free;
-    return self;
+    return b_heap_new_capacity(cmp, node_free, BHEAP_DEFAULT_CAPACITY);
+}
+
+BHeap *b_heap_new(BHeapNodeCompareFunc cmp)
+{
+    return b_heap_new_full(cmp, free);
+}
+
+size_t b_heap_bytes(size_t capacity)
+{
+    return sizeof(BHeap) + sizeof(BHeapNode) * capacity;
 }
 
 void b_heap_free(BHeap *self)
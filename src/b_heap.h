@@ -8,6 +8,10 @@ typedef void(*BHeapNodeFreeFunc)(void *node);
 
 BHeap *b_heap_new(BHeapNodeCompareFunc cmp);
 BHeap *b_heap_new_full(BHeapNodeCompareFunc cmp, BHeapNodeFreeFunc node_free);
+// starts with room for capacity nodes instead of BHEAP_DEFAULT_CAPACITY
+BHeap *b_heap_new_capacity(BHeapNodeCompareFunc cmp,
+                           BHeapNodeFreeFunc node_free, size_t capacity);
+size_t b_heap_bytes(size_t capacity);
 void b_heap_free(BHeap *self);
 
 void b_heap_push(BHeap *self, void *data);
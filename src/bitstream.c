@@ -1,30 +1,71 @@
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #define BITSTREAM_BUFFER_SIZE 8
+#define BITSTREAM_WINDOW_SIZE 64
+#define BITSTREAM_IO_SIZE 4096
 #define FULL_BUFFER 0xFF
 
 typedef struct BitStream {
     u_int8_t pending;
     u_int8_t offset;
     int fd;
+    // errno of the first read or write that failed, 0 while none has
+    int error;
+    // reader side: bits not yet consumed live in the low `window_bits` bits
+    // of `window`, most significant first
+    size_t window;
+    u_int8_t window_bits;
+    size_t io_index;
+    size_t io_size;
+    size_t io_capacity;
+    u_int8_t io_buffer[];
 } BitStream;
 typedef BitStream BitStreamWriter;
 typedef BitStream BitStreamReader;
 
-BitStreamReader *bitstream_reader_new(char *file_path)
+static BitStream *bitstream_new_fd(int fd, size_t buffer_size)
 {
-    BitStreamReader *self = malloc(sizeof(*self));
+    BitStream *self = malloc(sizeof(*self) + buffer_size);
     self->pending = 0;
     self->offset = BITSTREAM_BUFFER_SIZE;
-    self->fd = open(file_path, O_RDONLY);
-    if (self->fd < 0) {
+    self->fd = fd;
+    self->error = 0;
+    self->window = 0;
+    self->window_bits = 0;
+    self->io_index = 0;
+    self->io_size = 0;
+    self->io_capacity = buffer_size;
+    return self;
+}
+
+size_t bitstream_size(size_t buffer_size)
+{
+    return sizeof(BitStream) + buffer_size;
+}
+
+BitStreamReader *bitstream_reader_new_full(int fd, size_t buffer_size)
+{
+    return bitstream_new_fd(fd, buffer_size);
+}
+
+BitStreamReader *bitstream_reader_new_fd(int fd)
+{
+    return bitstream_reader_new_full(fd, BITSTREAM_IO_SIZE);
+}
+
+BitStreamReader *bitstream_reader_new(char *file_path)
+{
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0) {
         return NULL;
     }
-    return self;
+    return bitstream_reader_new_fd(fd);
 }
 
 BitStreamReader *bitstream_reader_new_offset(char *file_path, size_t offset)
@@ -34,50 +75,100 @@ BitStreamReader *bitstream_reader_new_offset(char *file_path, size_t offset)
     return self;
 }
 
+BitStreamWriter *bitstream_writer_new_full(int fd, size_t buffer_size)
+{
+    return bitstream_new_fd(fd, buffer_size);
+}
+
+BitStreamWriter *bitstream_writer_new_fd(int fd)
+{
+    return bitstream_writer_new_full(fd, BITSTREAM_IO_SIZE);
+}
+
 BitStreamWriter *bitstream_writer_new(char *file_path)
 {
-    BitStreamWriter *self = malloc(sizeof(*self));
-    self->pending = 0;
-    self->offset = BITSTREAM_BUFFER_SIZE;
     mode_t permissions = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH;
-    self->fd = open(file_path, O_WRONLY | O_CREAT | O_APPEND, permissions);
-    if (self->fd < 0) {
+    int fd = open(file_path, O_WRONLY | O_CREAT | O_APPEND, permissions);
+    if (fd < 0) {
         return NULL;
     }
-    return self;
+    return bitstream_writer_new_fd(fd);
 }
 
-void bitstream_flush(BitStream *bs)
+static void bitstream_drain(BitStreamWriter *bs)
+{
+    size_t written = 0;
+    while (bs->error == 0 && written < bs->io_size) {
+        ssize_t write_status =
+            write(bs->fd, bs->io_buffer + written, bs->io_size - written);
+        if (write_status <= 0) {
+            bs->error = write_status < 0 ? errno : EIO;
+            break;
+        }
+        written += write_status;
+    }
+    bs->io_size = 0;
+}
+
+static void bitstream_put_byte(BitStreamWriter *bs, u_int8_t byte)
+{
+    bs->io_buffer[bs->io_size] = byte;
+    bs->io_size += 1;
+    if (bs->io_size == bs->io_capacity) {
+        bitstream_drain(bs);
+    }
+}
+
+static void bitstream_put_pending(BitStreamWriter *bs)
 {
     if (bs->offset == BITSTREAM_BUFFER_SIZE) {
         return;
     }
 
-    write(bs->fd, &bs->pending, 1);
+    bitstream_put_byte(bs, bs->pending);
     bs->pending = 0;
     bs->offset = BITSTREAM_BUFFER_SIZE;
 }
 
-void bitstream_reader_close(BitStreamReader *self)
+void bitstream_flush(BitStream *bs)
+{
+    bitstream_put_pending(bs);
+    bitstream_drain(bs);
+}
+
+static int bitstream_close(BitStream *self)
 {
-    close(self->fd);
+    int error = self->error;
+    if (close(self->fd) < 0 && error == 0) {
+        error = errno;
+    }
     free(self);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
 }
 
-void bitstream_writer_close(BitStreamWriter *self, bool flush)
+int bitstream_reader_close(BitStreamReader *self)
+{
+    return bitstream_close(self);
+}
+
+int bitstream_writer_close(BitStreamWriter *self, bool flush)
 {
     if (flush) {
-        bitstream_flush(self);
+        bitstream_put_pending(self);
     }
-    close(self->fd);
-    free(self);
+    bitstream_drain(self);
+    return bitstream_close(self);
 }
 
 ssize_t get_high_byte(size_t data, size_t offset)
 {
     ssize_t shift = offset - BITSTREAM_BUFFER_SIZE;
     if (shift >= 0) {
-        return (data & (FULL_BUFFER << shift)) >> shift;
+        return (data & ((size_t)FULL_BUFFER << shift)) >> shift;
     }
     return -1;
 }
@@ -104,8 +195,8 @@ ssize_t get_top_bits(size_t data, size_t n_bits, size_t offset)
     //    111   == mask << (offset - n_bits) = top_bits_mask
     //      001 == (top_bits_mask & data) >> offset
     offset -= n_bits;
-    size_t top_bits_mask = (FULL_BUFFER >> (BITSTREAM_BUFFER_SIZE - n_bits))
-                           << offset;
+    size_t top_bits_mask =
+        (size_t)(FULL_BUFFER >> (BITSTREAM_BUFFER_SIZE - n_bits)) << offset;
     return (top_bits_mask & data) >> offset;
 }
 
@@ -119,7 +210,7 @@ void bitstream_write_bit(BitStreamWriter *bs, u_int8_t bit)
     bs->offset -= 1;
 
     if (bs->offset == 0) {
-        bitstream_flush(bs);
+        bitstream_put_pending(bs);
     }
 }
 
@@ -132,14 +223,13 @@ void bitstream_write_data(BitStreamWriter *bs, size_t data, u_int8_t offset)
     } else if (bs->offset < BITSTREAM_BUFFER_SIZE && bs->offset > 0) {
         bs->pending |= get_top_bits(data, bs->offset, offset);
         offset -= bs->offset;
-        bitstream_flush(bs);
+        bitstream_put_pending(bs);
     }
 
     while (offset >= BITSTREAM_BUFFER_SIZE) {
         int high_byte = get_high_byte(data, offset);
         assert(high_byte >= 0 && high_byte <= 255);
-        u_int8_t buff = high_byte;
-        write(bs->fd, &buff, 1);
+        bitstream_put_byte(bs, high_byte);
         offset -= BITSTREAM_BUFFER_SIZE;
     }
 
@@ -149,18 +239,56 @@ void bitstream_write_data(BitStreamWriter *bs, size_t data, u_int8_t offset)
     }
 }
 
-int16_t bitstream_read_bit(BitStreamReader *bs)
+static bool bitstream_fill(BitStreamReader *bs)
 {
-    if (bs->offset == BITSTREAM_BUFFER_SIZE || bs->offset == 0) {
-        char c;
-        ssize_t read_status = read(bs->fd, &c, 1);
-        if (read_status <= 0) {
-            return -1;
+    while (bs->window_bits <= BITSTREAM_WINDOW_SIZE - BITSTREAM_BUFFER_SIZE) {
+        if (bs->io_index == bs->io_size) {
+            ssize_t read_status =
+                read(bs->fd, bs->io_buffer, bs->io_capacity);
+            if (read_status <= 0) {
+                bs->error = read_status < 0 ? errno : 0;
+                break;
+            }
+            bs->io_index = 0;
+            bs->io_size = read_status;
         }
-        bs->pending = c;
-        bs->offset = BITSTREAM_BUFFER_SIZE;
+        bs->window = bs->window << BITSTREAM_BUFFER_SIZE |
+                     bs->io_buffer[bs->io_index];
+        bs->io_index += 1;
+        bs->window_bits += BITSTREAM_BUFFER_SIZE;
     }
+    return bs->window_bits > 0;
+}
 
-    bs->offset -= 1;
-    return (bs->pending & (0x1 << bs->offset)) >> bs->offset;
+void bitstream_write_bytes(BitStreamWriter *bs, const u_int8_t *data,
+                           size_t size)
+{
+    if (bs->offset != BITSTREAM_BUFFER_SIZE) {
+        for (size_t i = 0; i < size; i++) {
+            bitstream_write_data(bs, data[i], BITSTREAM_BUFFER_SIZE);
+        }
+        return;
+    }
+
+    while (size > 0) {
+        size_t n = bs->io_capacity - bs->io_size;
+        n = n < size ? n : size;
+        memcpy(bs->io_buffer + bs->io_size, data, n);
+        bs->io_size += n;
+        data += n;
+        size -= n;
+        if (bs->io_size == bs->io_capacity) {
+            bitstream_drain(bs);
+        }
+    }
+}
+
+int16_t bitstream_read_bit(BitStreamReader *bs)
+{
+    if (bs->window_bits == 0 && !bitstream_fill(bs)) {
+        return -1;
+    }
+
+    bs->window_bits -= 1;
+    return (bs->window >> bs->window_bits) & 0x1;
 }
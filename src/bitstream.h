@@ -7,10 +7,22 @@ typedef struct BitStream_s BitStreamReader;
 BitStreamReader *bitstream_reader_new(char *file_path);
 BitStreamReader *bitstream_reader_new_offset(char *file_path, size_t offset);
 BitStreamWriter *bitstream_writer_new(char *file_path);
-void bitstream_reader_close(BitStreamReader *self);
-void bitstream_writer_close(BitStreamWriter *self, bool flush);
+// take ownership of fd, reading or writing from its current offset, through
+// a buffer of buffer_size bytes (4 KiB without one)
+BitStreamReader *bitstream_reader_new_fd(int fd);
+BitStreamReader *bitstream_reader_new_full(int fd, size_t buffer_size);
+BitStreamWriter *bitstream_writer_new_fd(int fd);
+BitStreamWriter *bitstream_writer_new_full(int fd, size_t buffer_size);
+// bytes a bitstream with a buffer of buffer_size takes
+size_t bitstream_size(size_t buffer_size);
+// return 0, or -1 with errno set if a read or write failed while the
+// stream was open
+int bitstream_reader_close(BitStreamReader *self);
+int bitstream_writer_close(BitStreamWriter *self, bool flush);
 void bitstream_flush(BitStreamWriter *bs);
 
 void bitstream_write_bit(BitStreamWriter *bs, u_int8_t bit);
 void bitstream_write_data(BitStreamWriter *bs, size_t data, u_int8_t offset);
+void bitstream_write_bytes(BitStreamWriter *bs, const u_int8_t *data,
+                           size_t size);
 int16_t bitstream_read_bit(BitStreamReader *bs);
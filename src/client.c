@@ -0,0 +1,61 @@
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+
+int huff_client_connect(char *socket_path)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket_fd < 0) {
+        return -1;
+    }
+    if (connect(socket_fd, (struct sockaddr *)&address, sizeof(address)) <
+        0) {
+        close(socket_fd);
+        return -1;
+    }
+    return socket_fd;
+}
+
+int huff_client_request(int socket_fd, HuffRequest *request, int in_fd,
+                        int out_fd, HuffResponse *response)
+{
+    int fds[2] = {in_fd, out_fd};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {.iov_base = request, .iov_len = sizeof(*request)};
+    struct msghdr message = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(socket_fd, &message, MSG_NOSIGNAL) != sizeof(*request)) {
+        return -1;
+    }
+
+    size_t received = 0;
+    while (received < sizeof(*response)) {
+        ssize_t n = recv(socket_fd, (char *)response + received,
+                         sizeof(*response) - received, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        received += n;
+    }
+    return 0;
+}
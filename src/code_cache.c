@@ -0,0 +1,229 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+typedef void (*CodeCacheFreeFunc)(void *value);
+
+typedef struct CodeCacheStats {
+    size_t hits;
+    size_t misses;
+    // puts over an existing entry, such as one the caller found stale
+    size_t replaced;
+    size_t evictions;
+} CodeCacheStats;
+
+typedef struct CodeCacheEntry {
+    u_int64_t hash;
+    void *value;
+    // holders of the entry, not counting the cache itself
+    size_t refs;
+    bool cached;
+    struct CodeCacheEntry *newer;
+    struct CodeCacheEntry *older;
+    struct CodeCacheEntry *next_in_bucket;
+    size_t key_size;
+    u_int8_t key[];
+} CodeCacheEntry;
+
+typedef struct CodeCache {
+    pthread_mutex_t lock;
+    CodeCacheEntry **buckets;
+    // a power of two
+    size_t n_buckets;
+    size_t size;
+    size_t capacity;
+    CodeCacheEntry *newest;
+    CodeCacheEntry *oldest;
+    CodeCacheFreeFunc free_value;
+    CodeCacheStats stats;
+} CodeCache;
+
+// FNV-1a
+static u_int64_t code_cache_hash(const u_int8_t *key, size_t key_size)
+{
+    u_int64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < key_size; i++) {
+        hash ^= key[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+CodeCache *code_cache_new(size_t capacity, CodeCacheFreeFunc free_value)
+{
+    CodeCache *self = malloc(sizeof(*self));
+    *self = (CodeCache){
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .n_buckets = 1,
+        .capacity = capacity,
+        .free_value = free_value,
+    };
+    while (self->n_buckets < 2 * capacity) {
+        self->n_buckets *= 2;
+    }
+    self->buckets = calloc(self->n_buckets, sizeof(*self->buckets));
+    return self;
+}
+
+// The most a cache of capacity entries takes, keys and values included.
+size_t code_cache_bytes(size_t capacity, size_t key_size, size_t value_size)
+{
+    size_t n_buckets = 1;
+    while (n_buckets < 2 * capacity) {
+        n_buckets *= 2;
+    }
+    return sizeof(CodeCache) + sizeof(CodeCacheEntry *) * n_buckets +
+           (sizeof(CodeCacheEntry) + key_size + value_size) * capacity;
+}
+
+static void code_cache_entry_free(CodeCache *self, CodeCacheEntry *entry)
+{
+    self->free_value(entry->value);
+    free(entry);
+}
+
+void code_cache_free(CodeCache *self)
+{
+    CodeCacheEntry *entry = self->newest;
+    while (entry != NULL) {
+        CodeCacheEntry *older = entry->older;
+        code_cache_entry_free(self, entry);
+        entry = older;
+    }
+    pthread_mutex_destroy(&self->lock);
+    free(self->buckets);
+    free(self);
+}
+
+static void code_cache_unlink(CodeCache *self, CodeCacheEntry *entry)
+{
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    } else {
+        self->newest = entry->older;
+    }
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    } else {
+        self->oldest = entry->newer;
+    }
+}
+
+static void code_cache_push_newest(CodeCache *self, CodeCacheEntry *entry)
+{
+    entry->newer = NULL;
+    entry->older = self->newest;
+    if (self->newest != NULL) {
+        self->newest->newer = entry;
+    } else {
+        self->oldest = entry;
+    }
+    self->newest = entry;
+}
+
+// with self->lock held
+static CodeCacheEntry *code_cache_find(CodeCache *self, u_int64_t hash,
+                                       const void *key, size_t key_size)
+{
+    CodeCacheEntry *entry = self->buckets[hash & (self->n_buckets - 1)];
+    for (; entry != NULL; entry = entry->next_in_bucket) {
+        if (entry->hash == hash && entry->key_size == key_size &&
+            memcmp(entry->key, key, key_size) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// with self->lock held
+static void code_cache_remove(CodeCache *self, CodeCacheEntry *entry)
+{
+    CodeCacheEntry **link = &self->buckets[entry->hash & (self->n_buckets - 1)];
+    while (*link != entry) {
+        link = &(*link)->next_in_bucket;
+    }
+    *link = entry->next_in_bucket;
+    code_cache_unlink(self, entry);
+    self->size -= 1;
+
+    entry->cached = false;
+    if (entry->refs == 0) {
+        code_cache_entry_free(self, entry);
+    }
+}
+
+// Returns the entry for the key, which the caller has to release, or NULL
+// if there is none.
+CodeCacheEntry *code_cache_get(CodeCache *self, const void *key,
+                               size_t key_size)
+{
+    u_int64_t hash = code_cache_hash(key, key_size);
+    pthread_mutex_lock(&self->lock);
+    CodeCacheEntry *entry = code_cache_find(self, hash, key, key_size);
+    if (entry != NULL) {
+        code_cache_unlink(self, entry);
+        code_cache_push_newest(self, entry);
+        entry->refs += 1;
+        self->stats.hits += 1;
+    } else {
+        self->stats.misses += 1;
+    }
+    pthread_mutex_unlock(&self->lock);
+    return entry;
+}
+
+// Adds the value under the key, in place of any entry already there, and
+// returns its entry, which the caller has to release.
+CodeCacheEntry *code_cache_put(CodeCache *self, const void *key,
+                               size_t key_size, void *value)
+{
+    u_int64_t hash = code_cache_hash(key, key_size);
+    pthread_mutex_lock(&self->lock);
+    CodeCacheEntry *entry = code_cache_find(self, hash, key, key_size);
+    if (entry != NULL) {
+        code_cache_remove(self, entry);
+        self->stats.replaced += 1;
+    }
+
+    entry = malloc(sizeof(*entry) + key_size);
+    entry->hash = hash;
+    entry->value = value;
+    entry->refs = 1;
+    entry->cached = true;
+    entry->key_size = key_size;
+    memcpy(entry->key, key, key_size);
+    CodeCacheEntry **bucket = &self->buckets[hash & (self->n_buckets - 1)];
+    entry->next_in_bucket = *bucket;
+    *bucket = entry;
+    code_cache_push_newest(self, entry);
+    self->size += 1;
+    while (self->size > self->capacity) {
+        code_cache_remove(self, self->oldest);
+        self->stats.evictions += 1;
+    }
+    pthread_mutex_unlock(&self->lock);
+    return entry;
+}
+
+void *code_cache_value(CodeCacheEntry *entry) { return entry->value; }
+
+void code_cache_release(CodeCache *self, CodeCacheEntry *entry)
+{
+    pthread_mutex_lock(&self->lock);
+    entry->refs -= 1;
+    bool evicted = !entry->cached && entry->refs == 0;
+    pthread_mutex_unlock(&self->lock);
+    if (evicted) {
+        code_cache_entry_free(self, entry);
+    }
+}
+
+CodeCacheStats code_cache_stats(CodeCache *self)
+{
+    pthread_mutex_lock(&self->lock);
+    CodeCacheStats stats = self->stats;
+    pthread_mutex_unlock(&self->lock);
+    return stats;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <stdlib.h>
+#include <sys/types.h>
+
+typedef struct CodeCache_s CodeCache;
+typedef struct CodeCacheEntry_s CodeCacheEntry;
+typedef void (*CodeCacheFreeFunc)(void *value);
+
+typedef struct CodeCacheStats {
+    size_t hits;
+    size_t misses;
+    // puts over an existing entry, such as one the caller found stale
+    size_t replaced;
+    size_t evictions;
+} CodeCacheStats;
+
+// A least-recently-used map from byte strings to values, safe to share
+// between threads. Entries handed out by get and put stay valid, even once
+// evicted or replaced, until they are released.
+CodeCache *code_cache_new(size_t capacity, CodeCacheFreeFunc free_value);
+void code_cache_free(CodeCache *self);
+size_t code_cache_bytes(size_t capacity, size_t key_size, size_t value_size);
+
+CodeCacheEntry *code_cache_get(CodeCache *self, const void *key,
+                               size_t key_size);
+CodeCacheEntry *code_cache_put(CodeCache *self, const void *key,
+                               size_t key_size, void *value);
+void *code_cache_value(CodeCacheEntry *entry);
+void code_cache_release(CodeCache *self, CodeCacheEntry *entry);
+CodeCacheStats code_cache_stats(CodeCache *self);
@@ -0,0 +1,191 @@
+#include "context.h"
+#include <math.h>
+#include <string.h>
+
+// symbols counted per context before the counts are halved, so they fit
+// in 32 bits
+#define CONTEXT_MAX_COUNT ((size_t)1 << 31)
+// bits a tree costs in the header for each of its leaves, near enough
+#define CONTEXT_LEAF_BITS 32
+// most times contexts are moved between trees once they are all seeded
+#define CONTEXT_ROUNDS 16
+
+// Clears the counts for a new input, whose first symbol is counted as if a
+// '\0' came before it.
+void context_start(ContextModel *self)
+{
+    memset(self->counts, 0, sizeof(self->counts));
+    self->last = 0;
+    self->n_counted = 0;
+    self->empty = true;
+}
+
+// Counts each symbol under the byte before it.
+void context_count(ContextModel *self, const u_int16_t *symbols,
+                   size_t n_symbols)
+{
+    for (size_t i = 0; i < n_symbols; i++) {
+        u_int16_t symbol = symbols[i];
+        self->counts[self->last][symbol] += 1;
+        if (symbol < CONTEXT_N_CHARACTERS) {
+            self->last = symbol;
+        }
+        self->empty = self->empty && symbol == RLE_EOB;
+    }
+    self->n_counted += n_symbols;
+    if (self->n_counted > CONTEXT_MAX_COUNT) {
+        for (size_t c = 0; c < CONTEXT_N_CHARACTERS; c++) {
+            for (size_t s = 0; s < CONTEXT_N_SYMBOLS; s++) {
+                self->counts[c][s] = (self->counts[c][s] + 1) / 2;
+            }
+        }
+        self->n_counted = (self->n_counted + 1) / 2;
+    }
+}
+
+// Without run-length encoding the end-of-block symbol is counted here, as
+// the context payload always ends with one. Returns false for an empty
+// input.
+bool context_finish(ContextModel *self, bool rle)
+{
+    if (!rle) {
+        self->counts[self->last][RLE_EOB] += 1;
+    }
+    return !self->empty;
+}
+
+// Bits each symbol would take under the counts. Symbols they have not seen
+// are charged about as much as the rarest ones they have.
+static void context_costs(const size_t *counts, double *costs)
+{
+    double total = 0;
+    for (size_t s = 0; s < CONTEXT_N_SYMBOLS; s++) {
+        total += counts[s];
+    }
+    for (size_t s = 0; s < CONTEXT_N_SYMBOLS; s++) {
+        costs[s] = log2((total + 0.5 * CONTEXT_N_SYMBOLS) / (counts[s] + 0.5));
+    }
+}
+
+static double context_cost(const u_int32_t *counts, const double *costs)
+{
+    double bits = 0;
+    for (size_t s = 0; s < CONTEXT_N_SYMBOLS; s++) {
+        bits += counts[s] * costs[s];
+    }
+    return bits;
+}
+
+// Bits any code takes for the counts of one context at least, and how many
+// symbols it has seen.
+static double context_entropy_bits(const u_int32_t *counts, size_t *n_leaves)
+{
+    size_t total = 0;
+    *n_leaves = 0;
+    for (size_t s = 0; s < CONTEXT_N_SYMBOLS; s++) {
+        total += counts[s];
+        *n_leaves += counts[s] > 0;
+    }
+    double bits = 0;
+    for (size_t s = 0; s < CONTEXT_N_SYMBOLS; s++) {
+        if (counts[s] > 0) {
+            bits += counts[s] * log2((double)total / counts[s]);
+        }
+    }
+    return bits;
+}
+
+// Sums the counts of every context into its tree's, and recomputes the
+// costs under each tree.
+static void context_sum(ContextModel *self, double costs[][CONTEXT_N_SYMBOLS])
+{
+    memset(self->sums, 0, sizeof(self->sums));
+    for (size_t c = 0; c < CONTEXT_N_CHARACTERS; c++) {
+        for (size_t s = 0; s < CONTEXT_N_SYMBOLS; s++) {
+            self->sums[self->map[c]][s] += self->counts[c][s];
+        }
+    }
+    for (size_t t = 0; t < self->n_trees; t++) {
+        context_costs(self->sums[t], costs[t]);
+    }
+}
+
+// Moves every context to the tree its counts cost the fewest bits under.
+// Returns how many moved.
+static size_t context_assign(ContextModel *self,
+                             double costs[][CONTEXT_N_SYMBOLS])
+{
+    size_t n_moved = 0;
+    for (size_t c = 0; c < CONTEXT_N_CHARACTERS; c++) {
+        size_t best = self->map[c];
+        double best_bits = context_cost(self->counts[c], costs[best]);
+        for (size_t t = 0; t < self->n_trees; t++) {
+            double bits = context_cost(self->counts[c], costs[t]);
+            if (bits < best_bits) {
+                best = t;
+                best_bits = bits;
+            }
+        }
+        n_moved += best != self->map[c];
+        self->map[c] = best;
+    }
+    context_sum(self, costs);
+    return n_moved;
+}
+
+// Groups the contexts into up to CONTEXT_MAX_TREES trees. Starting from
+// one, the context that the trees so far code worst against its own counts
+// seeds a new tree, as long as that saves more than the tree costs in the
+// header; then contexts move between trees until none would gain.
+void context_cluster(ContextModel *self)
+{
+    double costs[CONTEXT_MAX_TREES][CONTEXT_N_SYMBOLS];
+    memset(self->map, 0, sizeof(self->map));
+    self->n_trees = 1;
+    context_sum(self, costs);
+
+    while (self->n_trees < CONTEXT_MAX_TREES) {
+        size_t seed = 0;
+        double seed_gain = 0;
+        for (size_t c = 0; c < CONTEXT_N_CHARACTERS; c++) {
+            size_t n_leaves;
+            double own = context_entropy_bits(self->counts[c], &n_leaves);
+            double gain =
+                context_cost(self->counts[c], costs[self->map[c]]) - own -
+                CONTEXT_LEAF_BITS * n_leaves;
+            if (gain > seed_gain) {
+                seed = c;
+                seed_gain = gain;
+            }
+        }
+        if (seed_gain <= 0) {
+            break;
+        }
+        self->map[seed] = self->n_trees;
+        self->n_trees += 1;
+        context_sum(self, costs);
+        context_assign(self, costs);
+    }
+    for (size_t round = 0; round < CONTEXT_ROUNDS; round++) {
+        if (context_assign(self, costs) == 0) {
+            break;
+        }
+    }
+
+    // every context that was seen can move away from a tree; number the
+    // rest from 0, and send the unseen ones to the first
+    u_int8_t renumber[CONTEXT_MAX_TREES];
+    size_t n_trees = 0;
+    for (size_t t = 0; t < self->n_trees; t++) {
+        size_t total = 0;
+        for (size_t s = 0; s < CONTEXT_N_SYMBOLS; s++) {
+            total += self->sums[t][s];
+        }
+        renumber[t] = total > 0 ? n_trees++ : 0;
+    }
+    for (size_t c = 0; c < CONTEXT_N_CHARACTERS; c++) {
+        self->map[c] = renumber[self->map[c]];
+    }
+    self->n_trees = n_trees;
+    context_sum(self, costs);
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "kernels.h"
+#include "rle.h"
+
+#define CONTEXT_N_CHARACTERS KERNEL_N_LITERALS
+#define CONTEXT_N_SYMBOLS RLE_N_SYMBOLS
+#define CONTEXT_MAX_TREES KERNEL_MAX_CONTEXT_TABLES
+
+// Order-1 statistics: how often each symbol follows each byte, and once
+// they are clustered, the n_trees trees the bytes share, the tree each byte
+// picks for the symbol after it, and the counts each tree is built from.
+typedef struct ContextModel {
+    u_int32_t counts[CONTEXT_N_CHARACTERS][CONTEXT_N_SYMBOLS];
+    u_int8_t last;
+    size_t n_counted;
+    bool empty;
+    size_t n_trees;
+    u_int8_t map[CONTEXT_N_CHARACTERS];
+    size_t sums[CONTEXT_MAX_TREES][CONTEXT_N_SYMBOLS];
+} ContextModel;
+
+void context_start(ContextModel *self);
+void context_count(ContextModel *self, const u_int16_t *symbols,
+                   size_t n_symbols);
+bool context_finish(ContextModel *self, bool rle);
+void context_cluster(ContextModel *self);
@@ -1,7 +1,10 @@
 #include "b_heap.h"
 #include "bitstream.h"
+#include "kernels.h"
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 typedef struct HuffmanNode {
     int symbol;
@@ -18,9 +21,9 @@ typedef struct HuffmanCode {
 
 int h_node_compare(void *hnode_a, void *hnode_b)
 {
-    int diff =
-        (int)(((HuffmanNode *)hnode_a)->freq - ((HuffmanNode *)hnode_b)->freq);
-    return -diff;
+    size_t freq_a = ((HuffmanNode *)hnode_a)->freq;
+    size_t freq_b = ((HuffmanNode *)hnode_b)->freq;
+    return (freq_a < freq_b) - (freq_a > freq_b);
 }
 
 void h_node_print(void *node)
@@ -59,6 +62,9 @@ HuffmanNode *h_leaf_new(int sym, size_t freq)
     HuffmanNode *self = malloc(sizeof(*self));
     self->symbol = sym;
     self->freq = freq;
+    self->parent = NULL;
+    self->left = NULL;
+    self->right = NULL;
     return self;
 }
 
@@ -76,6 +82,19 @@ size_t h_tree_size(HuffmanNode *root)
     return count;
 }
 
+// bytes the nodes of a tree with n_leaves leaves take at most
+size_t h_tree_bytes(size_t n_leaves)
+{
+    return sizeof(HuffmanNode) * (2 * n_leaves - 1);
+}
+
+size_t h_tree_depth(HuffmanNode *root)
+{
+    size_t depth_l = root->left ? 1 + h_tree_depth(root->left) : 0;
+    size_t depth_r = root->right ? 1 + h_tree_depth(root->right) : 0;
+    return depth_l > depth_r ? depth_l : depth_r;
+}
+
 void h_tree_write(FILE *stream, HuffmanNode *root)
 {
     fprintf(stream, "%c", root->symbol);
@@ -116,8 +135,8 @@ size_t reverse_bits(size_t num, size_t n_bits)
 {
     size_t reverse_num = 0;
     for (size_t i = 0; i < n_bits; i++) {
-        if ((num & (1 << i))) {
-            reverse_num |= 1 << ((n_bits - 1) - i);
+        if ((num & ((size_t)1 << i))) {
+            reverse_num |= (size_t)1 << ((n_bits - 1) - i);
         }
     }
     return reverse_num;
@@ -148,6 +167,105 @@ HuffmanCode h_tree_bubble(HuffmanNode *leaf, HuffmanCode h_code)
     return (HuffmanCode){0};
 }
 
+bool h_node_is_leaf(HuffmanNode *node)
+{
+    return node->left == NULL && node->right == NULL;
+}
+
+#define H_TREE_WIDE_BRANCH 0x00
+#define H_TREE_WIDE_LEAF 0x01
+
+void h_tree_write_wide(FILE *stream, HuffmanNode *root)
+{
+    if (h_node_is_leaf(root)) {
+        fputc(H_TREE_WIDE_LEAF, stream);
+        fputc((root->symbol >> 8) & 0xff, stream);
+        fputc(root->symbol & 0xff, stream);
+        return;
+    }
+    fputc(H_TREE_WIDE_BRANCH, stream);
+    h_tree_write_wide(stream, root->left);
+    h_tree_write_wide(stream, root->right);
+}
+
+HuffmanNode *h_tree_from_file_wide(HuffmanNode *parent, FILE *tree_file)
+{
+    int c = fgetc(tree_file);
+    if (c == EOF) {
+        return NULL;
+    }
+
+    HuffmanNode *node = h_leaf_new(0, 0);
+    node->parent = parent;
+    if (c == H_TREE_WIDE_BRANCH) {
+        node->left = h_tree_from_file_wide(node, tree_file);
+        node->right = h_tree_from_file_wide(node, tree_file);
+        return node;
+    }
+
+    int hi = fgetc(tree_file);
+    int lo = fgetc(tree_file);
+    node->symbol = hi << 8 | lo;
+    return node;
+}
+
+// Copies a tree as h_tree_write or h_tree_write_wide left it from tree_file
+// to buffer without building it, so that only trees it passed get built.
+// Returns its size, or 0 if the file ends first, the tree takes more than
+// max_size bytes, has more leaves than its n_symbols symbols or codes
+// longer than max_depth (at most 63) bits, or a wide leaf is not one of
+// the symbols.
+size_t h_tree_scan(FILE *tree_file, bool wide, u_int8_t *buffer,
+                   size_t max_size, size_t n_symbols, size_t max_depth)
+{
+    size_t size = 0;
+    size_t n_leaves = 0;
+    // depth of the next node, and a bit for each node on the way down to
+    // it that is a right subtree
+    size_t depth = 0;
+    u_int64_t rights = 0;
+    for (bool done = false; !done;) {
+        int c = fgetc(tree_file);
+        bool branch = wide ? c == H_TREE_WIDE_BRANCH : c == '\0';
+        size_t n_bytes = wide && !branch ? 3 : 1;
+        if (c == EOF || size + n_bytes > max_size ||
+            (wide && !branch && c != H_TREE_WIDE_LEAF)) {
+            return 0;
+        }
+        buffer[size++] = c;
+        for (size_t i = 1; i < n_bytes; i++) {
+            if ((c = fgetc(tree_file)) == EOF) {
+                return 0;
+            }
+            buffer[size++] = c;
+        }
+        if (wide && !branch &&
+            (size_t)(buffer[size - 2] << 8 | buffer[size - 1]) >= n_symbols) {
+            return 0;
+        }
+
+        if (branch) {
+            // on to its left subtree
+            if (++depth > max_depth) {
+                return 0;
+            }
+            rights &= ~((u_int64_t)1 << depth);
+            continue;
+        }
+        if (++n_leaves > n_symbols) {
+            return 0;
+        }
+        // up past the right subtrees this leaf ends, then on to the right
+        // subtree of the first branch whose left one it ends
+        while (depth > 0 && (rights >> depth & 0x1)) {
+            depth -= 1;
+        }
+        rights |= (u_int64_t)1 << depth;
+        done = depth == 0;
+    }
+    return size;
+}
+
 HuffmanNode *h_tree_from_file(HuffmanNode *parent, FILE *tree_file)
 {
     int c = fgetc(tree_file);
@@ -234,7 +352,7 @@ int h_tree_read_encoded_char(HuffmanNode *self, BitStreamReader *encoded_file)
             node = node->right;
         }
 
-        if (node->symbol != '\0') {
+        if (h_node_is_leaf(node)) {
             return node->symbol;
         }
 
@@ -242,3 +360,111 @@ int h_tree_read_encoded_char(HuffmanNode *self, BitStreamReader *encoded_file)
     }
     return EOF;
 }
+
+static u_int16_t h_table_flatten(HuffmanNode *node, KernelNode *nodes,
+                                 u_int16_t *n_nodes)
+{
+    if (h_node_is_leaf(node)) {
+        return KERNEL_LEAF | node->symbol;
+    }
+    u_int16_t index = *n_nodes;
+    *n_nodes += 1;
+    nodes[index].child[0] = h_table_flatten(node->left, nodes, n_nodes);
+    nodes[index].child[1] = h_table_flatten(node->right, nodes, n_nodes);
+    return index;
+}
+
+// Flattens the tree into the layout the decode kernels read and fills the
+// lookup table: each entry holds every symbol whose code fits completely in
+// its KERNEL_TABLE_BITS bits, up to KERNEL_TABLE_MAX_SYMBOLS of them.
+void h_table_build(KernelDecodeTable *self, HuffmanNode *root)
+{
+    u_int16_t n_nodes = 0;
+    self->root = h_table_flatten(root, self->nodes, &n_nodes);
+    if (self->root & KERNEL_LEAF) {
+        return;
+    }
+
+    for (size_t i = 0; i < KERNEL_TABLE_SIZE; i++) {
+        KernelTableEntry *entry = &self->entries[i];
+        u_int16_t node = self->root;
+        entry->n_symbols = 0;
+        entry->n_bits = 0;
+
+        for (u_int8_t bit = 1; bit <= KERNEL_TABLE_BITS; bit++) {
+            node = self->nodes[node].child[(i >> (KERNEL_TABLE_BITS - bit)) &
+                                           0x1];
+            if (node & KERNEL_LEAF) {
+                entry->symbols[entry->n_symbols] = node & ~KERNEL_LEAF;
+                entry->n_symbols += 1;
+                entry->n_bits = bit;
+                node = self->root;
+                if (entry->n_symbols == KERNEL_TABLE_MAX_SYMBOLS) {
+                    break;
+                }
+            }
+        }
+
+        entry->node = node;
+        if (entry->n_symbols == 0) {
+            entry->n_bits = KERNEL_TABLE_BITS;
+        }
+    }
+}
+
+KernelDecodeTable *h_table_new(HuffmanNode *root)
+{
+    KernelDecodeTable *self = malloc(sizeof(*self));
+    h_table_build(self, root);
+    return self;
+}
+
+void h_table_free(KernelDecodeTable *self) { free(self); }
+
+// h_table_build for order-1 decoding: table t is filled from roots[t], and
+// an entry carries on with the tree map picks for each byte it decodes.
+// Each tree needs two leaves at least.
+void h_context_tables_build(KernelContextTables *self, HuffmanNode **roots,
+                            size_t n_trees, const u_int8_t *map)
+{
+    memcpy(self->map, map, sizeof(self->map));
+    u_int16_t n_nodes = 0;
+    for (size_t t = 0; t < n_trees; t++) {
+        self->roots[t] = h_table_flatten(roots[t], self->nodes, &n_nodes);
+    }
+
+    for (size_t t = 0; t < n_trees; t++) {
+        for (size_t i = 0; i < KERNEL_CONTEXT_TABLE_SIZE; i++) {
+            KernelTableEntry *entry = &self->entries[t][i];
+            u_int16_t table = t;
+            u_int16_t node = self->roots[t];
+            entry->n_symbols = 0;
+            entry->n_bits = 0;
+
+            for (u_int8_t bit = 1; bit <= KERNEL_CONTEXT_TABLE_BITS; bit++) {
+                size_t branch = (i >> (KERNEL_CONTEXT_TABLE_BITS - bit)) & 0x1;
+                node = self->nodes[node].child[branch];
+                if (node & KERNEL_LEAF) {
+                    u_int16_t symbol = node & ~KERNEL_LEAF;
+                    entry->symbols[entry->n_symbols] = symbol;
+                    entry->n_symbols += 1;
+                    entry->n_bits = bit;
+                    if (symbol < KERNEL_N_LITERALS) {
+                        table = map[symbol];
+                    }
+                    node = self->roots[table];
+                    if (entry->n_symbols == KERNEL_TABLE_MAX_SYMBOLS) {
+                        break;
+                    }
+                }
+            }
+
+            if (entry->n_symbols == 0) {
+                entry->node = node;
+                entry->n_bits = KERNEL_CONTEXT_TABLE_BITS;
+            } else {
+                entry->node = table;
+            }
+        }
+    }
+}
@@ -1,4 +1,6 @@
 #include "src/bitstream.h"
+#include "src/kernels.h"
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -14,12 +16,25 @@ void h_node_free(void *self);
 HuffmanNode *h_branch_new(HuffmanNode *leaf_l, HuffmanNode *leaf_r);
 HuffmanNode *h_leaf_new(int sym, size_t freq);
 size_t h_tree_size(HuffmanNode *root);
+size_t h_tree_depth(HuffmanNode *root);
+size_t h_tree_bytes(size_t n_leaves);
 
 void h_tree_write(FILE *stream, HuffmanNode *root);
 HuffmanCode h_tree_search(HuffmanNode *node, int c, HuffmanCode h_code);
 size_t reverse_bits(size_t num, size_t n_bits);
 HuffmanCode h_tree_bubble(HuffmanNode *leaf, HuffmanCode h_code);
 HuffmanNode *h_tree_from_file(HuffmanNode *parent, FILE *tree_file);
+bool h_node_is_leaf(HuffmanNode *node);
+void h_tree_write_wide(FILE *stream, HuffmanNode *root);
+HuffmanNode *h_tree_from_file_wide(HuffmanNode *parent, FILE *tree_file);
+size_t h_tree_scan(FILE *tree_file, bool wide, u_int8_t *buffer,
+                   size_t max_size, size_t n_symbols, size_t max_depth);
 HuffmanNode *h_tree_from_buffer(char buffer[]);
 int h_tree_read_encoded_char(HuffmanNode *self, BitStreamReader *bs);
 char *h_tree_to_string(HuffmanNode *head);
+
+void h_table_build(KernelDecodeTable *self, HuffmanNode *root);
+KernelDecodeTable *h_table_new(HuffmanNode *root);
+void h_table_free(KernelDecodeTable *self);
+void h_context_tables_build(KernelContextTables *self, HuffmanNode **roots,
+                            size_t n_trees, const u_int8_t *map);
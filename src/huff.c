@@ -1,12 +1,29 @@
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "b_heap.h"
 #include "bitstream.h"
+#include "code_cache.h"
+#include "context.h"
 #include "h_tree.h"
+#include "huff.h"
+#include "kernels.h"
+#include "rle.h"
+#include "server.h"
+#include "trace.h"
+
+HUFF_TRACE_SEMAPHORE(histogram_done);
+HUFF_TRACE_SEMAPHORE(tree_built);
+HUFF_TRACE_SEMAPHORE(header_written);
+HUFF_TRACE_SEMAPHORE(payload_flushed);
+HUFF_TRACE_SEMAPHORE(decode_table_built);
+HUFF_TRACE_SEMAPHORE(decode_finished);
 
 HuffmanNode *huff_tree_from_heap(BHeap *heap)
 {
@@ -23,42 +40,302 @@ HuffmanNode *huff_tree_from_heap(BHeap *heap)
     return tree;
 }
 
-void huff_write_tree_to_file(HuffmanNode *tree, char *out_file_path)
+// bytes read, packed and written at a time, and the least a memory budget
+// can take that down to
+#define HUFF_IO_SIZE 65536
+#define HUFF_MIN_IO_SIZE 4096
+// stdio buffer headers are read through
+#define HUFF_FILE_BUFFER_SIZE 4096
+#define N_CHARACTERS 256
+#define N_SYMBOLS RLE_N_SYMBOLS
+// every tree a header passes fits the nodes the decode tables flatten it to
+static_assert(N_SYMBOLS <= KERNEL_MAX_SYMBOLS, "too many symbols to decode");
+#define HUFF_MAX_CHUNK_SYMBOLS(io_size) ((io_size) + RLE_MAX_EXTRA_SYMBOLS)
+// longest code bitstream_write_data and HuffmanCode are trusted with, and
+// that decoding accepts
+#define HUFF_MAX_CODE_LENGTH 32
+// first byte of files whose tree is written with h_tree_write_wide. Trees
+// in the original format have two leaves at least, so they start with a
+// '\0' branch, which is all an untagged header may start with
+#define HUFF_HEADER_WIDE 'W'
+#define HUFF_HEADER_BRANCH '\0'
+// the tag, then three bytes per leaf and one per branch at most
+#define HUFF_MAX_HEADER_SIZE (1 + 4 * N_SYMBOLS)
+// first byte of files coded with a tree per context, which follow it with
+// the number of trees, the tree each byte picks and the wide trees; like
+// 'W', it is never the branch an untagged header starts with
+#define HUFF_HEADER_CONTEXT 'C'
+#define HUFF_MAX_CONTEXT_TREES CONTEXT_MAX_TREES
+#define HUFF_MAX_CONTEXT_HEADER_SIZE                                           \
+    (2 + N_CHARACTERS + HUFF_MAX_CONTEXT_TREES * 4 * N_SYMBOLS)
+// the alphabet, then a bit per symbol
+#define HUFF_SYMBOL_SET_SIZE (1 + (N_SYMBOLS + 7) / 8)
+// how much more than a fresh code table a cached one may take
+#define HUFF_CACHE_SLACK 0.01
+// code tables serve keeps for each direction by default
+#define HUFF_CACHE_ENTRIES 64
+
+typedef struct HuffSymbolReader {
+    FILE *file;
+    Rle *rle;
+    bool use_rle;
+    bool finished;
+    // errno of a read that failed, which finishes the input early
+    int error;
+    size_t io_size;
+    u_int8_t *buffer;
+    u_int16_t *symbols;
+} HuffSymbolReader;
+
+void huff_symbol_reader_start(HuffSymbolReader *self, FILE *file, bool rle)
 {
-    FILE *out_file = fopen(out_file_path, "w");
-    h_tree_write(out_file, tree);
-    fclose(out_file);
+    self->file = file;
+    self->use_rle = rle;
+    self->finished = false;
+    self->error = 0;
+    // a read error finishes an input without flushing its last run
+    rle_reset(self->rle);
 }
 
-void huff_write_codes_to_file(HuffmanCode codes[], char *out_path,
-                              char *in_path)
+// Fills self->symbols with the next input bytes, or with their run-length
+// transform ending in RLE_EOB, and returns how many there are.
+size_t huff_symbol_reader_next(HuffSymbolReader *self)
 {
-    FILE *in_file = fopen(in_path, "r");
-    BitStreamWriter *bs = bitstream_writer_new(out_path);
-    int c;
-    while ((c = fgetc(in_file)) != EOF) {
-        HuffmanCode h_code = codes[c];
-        bitstream_write_data(bs, h_code.data, h_code.offset);
+    size_t n_symbols = 0;
+    while (n_symbols == 0 && !self->finished) {
+        size_t n_read = fread(self->buffer, 1, self->io_size, self->file);
+        if (n_read < self->io_size && ferror(self->file)) {
+            self->error = errno;
+            self->finished = true;
+            break;
+        }
+        if (!self->use_rle) {
+            for (size_t i = 0; i < n_read; i++) {
+                self->symbols[i] = self->buffer[i];
+            }
+            n_symbols = n_read;
+            self->finished = n_read == 0;
+        } else if (n_read == 0) {
+            n_symbols = rle_finish(self->rle, self->symbols);
+            self->finished = true;
+        } else {
+            n_symbols =
+                rle_encode(self->rle, self->buffer, n_read, self->symbols);
+        }
     }
-    fclose(in_file);
-    bitstream_writer_close(bs, true);
+    return n_symbols;
 }
 
-#define N_CHARACTERS 256
-BHeap *huff_create_node_heap(char *input_path, int *characters,
-                             HuffmanNode **leafs)
+typedef struct HuffOutput {
+    int fd;
+    int last;
+    size_t size;
+    size_t n_written;
+    size_t capacity;
+    u_int8_t *buffer;
+    // the end-of-block symbol has been reached
+    bool ended;
+    // errno of the first write that failed, 0 while none has
+    int error;
+} HuffOutput;
+
+// What encoding needs from a tree: the header it is written as and the code
+// of every symbol. Wide tables are written with h_tree_write_wide, and
+// their payload ends in RLE_EOB.
+typedef struct HuffEncodeTables {
+    bool wide;
+    KernelCode codes[N_SYMBOLS];
+    // bits the codes took for the counts they were built from, over the
+    // entropy of those counts
+    double efficiency;
+    size_t header_size;
+    u_int8_t header[HUFF_MAX_HEADER_SIZE];
+} HuffEncodeTables;
+
+// What order-1 encoding needs: the model of which symbols follow which
+// bytes, the codes of every tree it clusters them into and the header they
+// are written as.
+typedef struct HuffContextTables {
+    ContextModel model;
+    KernelCode codes[HUFF_MAX_CONTEXT_TREES][N_SYMBOLS];
+    size_t header_size;
+    u_int8_t header[HUFF_MAX_CONTEXT_HEADER_SIZE];
+} HuffContextTables;
+
+// Context-coded inputs have n_trees trees, picked through map, and their
+// lookup tables in context_tables; the rest have one tree and table. Either
+// table is NULL when there is no room for it, and decoding walks the trees.
+// Wide and context-coded payloads end in RLE_EOB, so an input that stops
+// before it has been cut short.
+typedef struct HuffDecodeTables {
+    bool wide;
+    bool context;
+    size_t n_trees;
+    HuffmanNode *trees[HUFF_MAX_CONTEXT_TREES];
+    u_int8_t map[N_CHARACTERS];
+    KernelDecodeTable *table;
+    KernelContextTables *context_tables;
+} HuffDecodeTables;
+
+// Buffers kept from one call to the next, so a long-lived caller such as the
+// server pays for them once. The tables are used when there is no cache;
+// the context ones are only allocated once an input needs them.
+struct HuffWorkspace_s {
+    const Kernels *kernels;
+    CodeCache *encode_cache;
+    CodeCache *decode_cache;
+    size_t io_size;
+    // room for order-1 encoding
+    bool context;
+    HuffSymbolReader reader;
+    HuffOutput output;
+    u_int8_t *packed;
+    u_int8_t *encoded;
+    u_int16_t *decoded;
+    HuffEncodeTables encode_tables;
+    HuffContextTables *context_encode_tables;
+    HuffDecodeTables decode_tables;
+    KernelDecodeTable *table;
+    KernelContextTables *context_tables;
+    char file_buffer[HUFF_FILE_BUFFER_SIZE];
+};
+
+// The caches may be NULL, and may be shared with other workspaces.
+HuffWorkspace *huff_workspace_new(const Kernels *kernels, const HuffPlan *plan,
+                                  CodeCache *encode_cache,
+                                  CodeCache *decode_cache)
 {
-    FILE *in_file = fopen(input_path, "r");
-    int c;
-    while ((c = fgetc(in_file)) != EOF) {
-        characters[(size_t)c] += 1;
+    size_t io_size = plan->io_size;
+    size_t n_chunk = HUFF_MAX_CHUNK_SYMBOLS(io_size);
+    HuffWorkspace *self = malloc(sizeof(*self));
+    self->kernels = kernels;
+    self->encode_cache = encode_cache;
+    self->decode_cache = decode_cache;
+    self->io_size = io_size;
+    self->context = plan->context;
+    self->reader.rle = rle_new();
+    self->reader.io_size = io_size;
+    self->reader.buffer = malloc(io_size);
+    self->reader.symbols = malloc(sizeof(*self->reader.symbols) * n_chunk);
+    self->output.capacity = io_size;
+    self->output.buffer = malloc(io_size);
+    self->packed = malloc(n_chunk * 4);
+    self->encoded = malloc(io_size);
+    self->decoded = malloc(sizeof(*self->decoded) * io_size);
+    self->context_encode_tables = NULL;
+    self->table = plan->table ? malloc(sizeof(*self->table)) : NULL;
+    self->context_tables = NULL;
+    return self;
+}
+
+void huff_workspace_free(HuffWorkspace *self)
+{
+    rle_free(self->reader.rle);
+    free(self->reader.buffer);
+    free(self->reader.symbols);
+    free(self->output.buffer);
+    free(self->packed);
+    free(self->encoded);
+    free(self->decoded);
+    free(self->context_encode_tables);
+    free(self->table);
+    free(self->context_tables);
+    free(self);
+}
+
+// What a workspace and one call through it take: the buffers, and a
+// bitstream, a heap, the trees of an input and two FILEs at most at any one
+// time. Room for tables is room for either kind, as decoding only finds
+// out which one it needs from the input.
+size_t huff_workspace_bytes(size_t io_size, bool table, bool context)
+{
+    size_t n_chunk = HUFF_MAX_CHUNK_SYMBOLS(io_size);
+    size_t bytes = sizeof(HuffWorkspace);
+    bytes += io_size + sizeof(u_int16_t) * n_chunk;  // reader
+    bytes += io_size;                                // output
+    bytes += n_chunk * 4;                            // packed
+    bytes += io_size + sizeof(u_int16_t) * io_size;  // encoded, decoded
+    bytes += table ? sizeof(KernelDecodeTable) + sizeof(KernelContextTables)
+                   : 0;
+    bytes += context ? sizeof(HuffContextTables) : 0;
+    bytes += bitstream_size(io_size) + b_heap_bytes(N_SYMBOLS) +
+             HUFF_MAX_CONTEXT_TREES * h_tree_bytes(N_SYMBOLS) +
+             2 * sizeof(FILE);
+    return bytes;
+}
+
+// 0, or -1 with errno set if reading the input failed.
+static int huff_reader_status(const HuffSymbolReader *reader)
+{
+    if (reader->error != 0) {
+        errno = reader->error;
+        return -1;
     }
-    fclose(in_file);
+    return 0;
+}
 
-    BHeap *heap = b_heap_new_full(h_node_compare, h_node_free);
-    for (size_t i = 0; i < N_CHARACTERS; i++) {
+// Closes the payload once the reader is done with the input.
+static int huff_writer_close(BitStreamWriter *bs,
+                             const HuffSymbolReader *reader)
+{
+    int status = bitstream_writer_close(bs, true);
+    return status < 0 ? status : huff_reader_status(reader);
+}
+
+// Returns 0, or -1 with errno set if reading or writing failed.
+int huff_write_codes(HuffWorkspace *ws, HuffEncodeTables *tables,
+                     FILE *in_file, int out_fd, bool rle)
+{
+    HuffSymbolReader *reader = &ws->reader;
+    huff_symbol_reader_start(reader, in_file, rle);
+    BitStreamWriter *bs = bitstream_writer_new_full(out_fd, ws->io_size);
+    bitstream_write_bytes(bs, tables->header, tables->header_size);
+    if (HUFF_TRACE_ENABLED(header_written)) {
+        HUFF_TRACE1(header_written, tables->header_size);
+    }
+    KernelPacker packer = {0};
+    size_t n_symbols;
+    while ((n_symbols = huff_symbol_reader_next(reader)) > 0) {
+        size_t n_packed = ws->kernels->pack(&packer, tables->codes,
+                                            reader->symbols, n_symbols,
+                                            ws->packed);
+        bitstream_write_bytes(bs, ws->packed, n_packed);
+        if (HUFF_TRACE_ENABLED(payload_flushed)) {
+            HUFF_TRACE2(payload_flushed, n_packed, n_symbols);
+        }
+    }
+    if (tables->wide && !rle) {
+        u_int16_t end = RLE_EOB;
+        size_t n_packed = ws->kernels->pack(&packer, tables->codes, &end, 1,
+                                            ws->packed);
+        bitstream_write_bytes(bs, ws->packed, n_packed);
+    }
+    bitstream_write_data(bs, packer.bits, packer.n_bits);
+    if (HUFF_TRACE_ENABLED(payload_flushed)) {
+        HUFF_TRACE2(payload_flushed, (packer.n_bits + 7) / 8, 0);
+    }
+    return huff_writer_close(bs, reader);
+}
+
+void huff_count_characters(HuffWorkspace *ws, FILE *in_file,
+                           size_t *characters, bool rle)
+{
+    HuffSymbolReader *reader = &ws->reader;
+    huff_symbol_reader_start(reader, in_file, rle);
+    size_t n_symbols;
+    while ((n_symbols = huff_symbol_reader_next(reader)) > 0) {
+        ws->kernels->histogram(reader->symbols, n_symbols, characters,
+                               N_SYMBOLS);
+    }
+}
+
+BHeap *huff_create_node_heap(size_t *characters, HuffmanNode **leafs)
+{
+    BHeap *heap = b_heap_new_capacity(h_node_compare, h_node_free, N_SYMBOLS);
+    for (size_t i = 0; i < N_SYMBOLS; i++) {
+        leafs[i] = NULL;
         if (characters[i] > 0) {
-            HuffmanNode *leaf = h_leaf_new((char)i, characters[i]);
+            HuffmanNode *leaf = h_leaf_new(i, characters[i]);
             leafs[i] = leaf;
             b_heap_push(heap, leaf);
         }
@@ -66,53 +343,1078 @@ BHeap *huff_create_node_heap(char *input_path, int *characters,
     return heap;
 }
 
-void huff_encode_file(char *input_path, char *output_path)
+// Halves the counts (keeping every present symbol at least 1) until the
+// tree is no deeper than HUFF_MAX_CODE_LENGTH, which skewed multi-gigabyte
+// inputs can otherwise exceed.
+HuffmanNode *huff_tree_from_counts(size_t *characters, HuffmanNode **leafs)
 {
-    int characters[N_CHARACTERS] = {0};
-    HuffmanNode *leaf_pointers[N_CHARACTERS] = {0};
-
-    BHeap *heap = huff_create_node_heap(input_path, characters, leaf_pointers);
+    BHeap *heap = huff_create_node_heap(characters, leafs);
     HuffmanNode *tree = huff_tree_from_heap(heap);
-
     b_heap_free(heap);
 
-    HuffmanCode codes[N_CHARACTERS] = {0};
-    for (int i = 0; i < N_CHARACTERS; i++) {
-        codes[i] = h_tree_bubble(leaf_pointers[i], (HuffmanCode){0});
+    while (tree != NULL && h_tree_depth(tree) > HUFF_MAX_CODE_LENGTH) {
+        h_node_free(tree);
+        for (size_t i = 0; i < N_SYMBOLS; i++) {
+            characters[i] = characters[i] / 2 + (characters[i] & 0x1);
+        }
+        heap = huff_create_node_heap(characters, leafs);
+        tree = huff_tree_from_heap(heap);
+        b_heap_free(heap);
     }
+    return tree;
+}
+
+// A lone leaf has an empty code, which the decoder could read forever; a
+// second one gives every code a bit.
+void huff_pad_lone_leaf(size_t *counts)
+{
+    size_t n_leaves = 0;
+    for (size_t s = 0; s < N_SYMBOLS; s++) {
+        n_leaves += counts[s] > 0;
+    }
+    for (size_t s = 0; n_leaves == 1; s++) {
+        n_leaves += counts[s] == 0;
+        counts[s] += counts[s] == 0;
+    }
+}
+
+// Bits the codes take for the counts.
+size_t huff_encoded_bits(const KernelCode *codes, const size_t *characters)
+{
+    size_t bits = 0;
+    for (size_t i = 0; i < N_SYMBOLS; i++) {
+        bits += characters[i] * codes[i].length;
+    }
+    return bits;
+}
 
-    huff_write_tree_to_file(tree, output_path);
-    huff_write_codes_to_file(codes, output_path, input_path);
+// Bits any code takes for the counts at least.
+double huff_entropy_bits(const size_t *characters)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < N_SYMBOLS; i++) {
+        total += characters[i];
+    }
+    double bits = 0;
+    for (size_t i = 0; i < N_SYMBOLS; i++) {
+        if (characters[i] > 0) {
+            bits += characters[i] * log2((double)total / characters[i]);
+        }
+    }
+    return bits;
+}
+
+void huff_trace_histogram_done(const size_t *characters, bool rle)
+{
+    size_t n_symbols = 0;
+    size_t n_distinct = 0;
+    for (size_t i = 0; i < N_SYMBOLS; i++) {
+        n_symbols += characters[i];
+        n_distinct += characters[i] > 0;
+    }
+    HUFF_TRACE3(histogram_done, n_symbols, n_distinct, rle);
+}
+
+void huff_trace_tree_built(const KernelCode *codes, const size_t *characters)
+{
+    size_t n_leaves = 0;
+    size_t n_symbols = 0;
+    u_int8_t shortest = HUFF_MAX_CODE_LENGTH;
+    u_int8_t longest = 0;
+    for (size_t i = 0; i < N_SYMBOLS; i++) {
+        if (characters[i] == 0) {
+            continue;
+        }
+        u_int8_t length = codes[i].length;
+        shortest = length < shortest ? length : shortest;
+        longest = length > longest ? length : longest;
+        n_leaves += 1;
+        n_symbols += characters[i];
+    }
+    size_t mean_millibits =
+        huff_encoded_bits(codes, characters) * 1000 / n_symbols;
+    HUFF_TRACE4(tree_built, n_leaves, shortest, longest, mean_millibits);
+}
+
+// Counts with the end-of-block symbol are written wide. Returns false for
+// an empty input, which has no tree.
+bool huff_encode_tables_build(HuffEncodeTables *self,
+                              const size_t *characters)
+{
+    size_t counts[N_SYMBOLS];
+    memcpy(counts, characters, sizeof(counts));
+    huff_pad_lone_leaf(counts);
+    HuffmanNode *leaf_pointers[N_SYMBOLS] = {0};
+    HuffmanNode *tree = huff_tree_from_counts(counts, leaf_pointers);
+    if (tree == NULL) {
+        return false;
+    }
 
+    for (int i = 0; i < N_SYMBOLS; i++) {
+        HuffmanCode code = h_tree_bubble(leaf_pointers[i], (HuffmanCode){0});
+        self->codes[i] = (KernelCode){code.data, code.offset};
+    }
+    double entropy = huff_entropy_bits(characters);
+    self->efficiency =
+        entropy > 0 ? huff_encoded_bits(self->codes, characters) / entropy : 1;
+    if (HUFF_TRACE_ENABLED(tree_built)) {
+        huff_trace_tree_built(self->codes, characters);
+    }
+
+    self->wide = characters[RLE_EOB] > 0;
+    FILE *header = fmemopen(self->header, sizeof(self->header), "w");
+    if (self->wide) {
+        fputc(HUFF_HEADER_WIDE, header);
+        h_tree_write_wide(header, tree);
+    } else {
+        h_tree_write(header, tree);
+    }
+    self->header_size = ftell(header);
+    fclose(header);
     h_node_free(tree);
+    return true;
+}
+
+// Whether tables built for other counts over the same symbols code these
+// nearly as well as fresh ones would.
+bool huff_encode_tables_fit(const HuffEncodeTables *self,
+                            const size_t *characters)
+{
+    double fresh_bits = huff_entropy_bits(characters) * self->efficiency;
+    return huff_encoded_bits(self->codes, characters) <=
+           fresh_bits * (1 + HUFF_CACHE_SLACK) + 1;
+}
+
+// The alphabet and which of its symbols are present: inputs with the same
+// symbol set can share code tables.
+static void huff_symbol_set(const size_t *characters, bool rle,
+                            u_int8_t *symbol_set)
+{
+    memset(symbol_set, 0, HUFF_SYMBOL_SET_SIZE);
+    symbol_set[0] = rle;
+    for (size_t i = 0; i < N_SYMBOLS; i++) {
+        symbol_set[1 + i / 8] |= (characters[i] > 0) << (i % 8);
+    }
+}
+
+// The tables for the counts, from the cache when an earlier input over the
+// same symbols left ones that still fit. Returns NULL for an empty input. A
+// cache entry is left in *entry for the caller to release.
+HuffEncodeTables *huff_encode_tables_get(HuffWorkspace *ws, size_t *characters,
+                                         bool rle, CodeCacheEntry **entry)
+{
+    if (ws->encode_cache == NULL) {
+        bool built = huff_encode_tables_build(&ws->encode_tables, characters);
+        return built ? &ws->encode_tables : NULL;
+    }
+
+    u_int8_t symbol_set[HUFF_SYMBOL_SET_SIZE];
+    huff_symbol_set(characters, rle, symbol_set);
+    *entry = code_cache_get(ws->encode_cache, symbol_set, sizeof(symbol_set));
+    if (*entry != NULL &&
+        huff_encode_tables_fit(code_cache_value(*entry), characters)) {
+        return code_cache_value(*entry);
+    }
+    if (*entry != NULL) {
+        code_cache_release(ws->encode_cache, *entry);
+        *entry = NULL;
+    }
+
+    HuffEncodeTables *tables = malloc(sizeof(*tables));
+    if (!huff_encode_tables_build(tables, characters)) {
+        free(tables);
+        return NULL;
+    }
+    *entry = code_cache_put(ws->encode_cache, symbol_set, sizeof(symbol_set),
+                            tables);
+    return tables;
+}
+
+CodeCache *huff_encode_cache_new(size_t capacity)
+{
+    return code_cache_new(capacity, free);
+}
+
+// Counts each symbol under the byte before it. Returns false for an empty
+// input.
+bool huff_context_count(HuffWorkspace *ws, ContextModel *model,
+                        FILE *in_file, bool rle)
+{
+    HuffSymbolReader *reader = &ws->reader;
+    huff_symbol_reader_start(reader, in_file, rle);
+    context_start(model);
+    size_t n_symbols;
+    while ((n_symbols = huff_symbol_reader_next(reader)) > 0) {
+        context_count(model, reader->symbols, n_symbols);
+    }
+    return context_finish(model, rle);
+}
+
+// histogram_done over every context, with the end-of-block symbol order-1
+// coding adds, and counts halved if the input was large enough that they
+// had to be.
+void huff_trace_context_histogram_done(const ContextModel *model, bool rle)
+{
+    size_t characters[N_SYMBOLS] = {0};
+    for (size_t c = 0; c < N_CHARACTERS; c++) {
+        for (size_t s = 0; s < N_SYMBOLS; s++) {
+            characters[s] += model->counts[c][s];
+        }
+    }
+    huff_trace_histogram_done(characters, rle);
+}
+
+// Builds a tree for each cluster of contexts and writes the header.
+void huff_context_tables_build(HuffContextTables *self)
+{
+    ContextModel *model = &self->model;
+    context_cluster(model);
+    FILE *header = fmemopen(self->header, sizeof(self->header), "w");
+    fputc(HUFF_HEADER_CONTEXT, header);
+    fputc(model->n_trees, header);
+    fwrite(model->map, 1, sizeof(model->map), header);
+    for (size_t t = 0; t < model->n_trees; t++) {
+        size_t counts[N_SYMBOLS];
+        memcpy(counts, model->sums[t], sizeof(counts));
+        huff_pad_lone_leaf(counts);
+
+        HuffmanNode *leaf_pointers[N_SYMBOLS] = {0};
+        HuffmanNode *tree = huff_tree_from_counts(counts, leaf_pointers);
+        for (size_t s = 0; s < N_SYMBOLS; s++) {
+            HuffmanCode code =
+                h_tree_bubble(leaf_pointers[s], (HuffmanCode){0});
+            self->codes[t][s] = (KernelCode){code.data, code.offset};
+        }
+        // once for each tree, counting the leaf a lone one is given
+        if (HUFF_TRACE_ENABLED(tree_built)) {
+            huff_trace_tree_built(self->codes[t], counts);
+        }
+        h_tree_write_wide(header, tree);
+        h_node_free(tree);
+    }
+    self->header_size = ftell(header);
+    fclose(header);
 }
 
-void huff_decode_file(char *encoded_path, char *decoded_path)
+// Returns 0, or -1 with errno set if reading or writing failed.
+int huff_context_write_codes(HuffWorkspace *ws, HuffContextTables *tables,
+                             FILE *in_file, int out_fd, bool rle)
 {
-    FILE *encoded_file = fopen(encoded_path, "r");
-    HuffmanNode *tree = h_tree_from_file(NULL, encoded_file);
-    size_t n_nodes = h_tree_size(tree);
+    HuffSymbolReader *reader = &ws->reader;
+    huff_symbol_reader_start(reader, in_file, rle);
+    BitStreamWriter *bs = bitstream_writer_new_full(out_fd, ws->io_size);
+    bitstream_write_bytes(bs, tables->header, tables->header_size);
+    if (HUFF_TRACE_ENABLED(header_written)) {
+        HUFF_TRACE1(header_written, tables->header_size);
+    }
+    // the first symbol is coded as if a '\0' came before it
+    const u_int8_t *map = tables->model.map;
+    KernelPacker packer = {.table = map[0]};
+    size_t n_symbols;
+    while ((n_symbols = huff_symbol_reader_next(reader)) > 0) {
+        size_t n_packed = ws->kernels->pack_context(
+            &packer, map, *tables->codes, N_SYMBOLS, reader->symbols,
+            n_symbols, ws->packed);
+        bitstream_write_bytes(bs, ws->packed, n_packed);
+        if (HUFF_TRACE_ENABLED(payload_flushed)) {
+            HUFF_TRACE2(payload_flushed, n_packed, n_symbols);
+        }
+    }
+    if (!rle) {
+        u_int16_t end = RLE_EOB;
+        size_t n_packed =
+            ws->kernels->pack_context(&packer, map, *tables->codes,
+                                      N_SYMBOLS, &end, 1, ws->packed);
+        bitstream_write_bytes(bs, ws->packed, n_packed);
+    }
+    bitstream_write_data(bs, packer.bits, packer.n_bits);
+    if (HUFF_TRACE_ENABLED(payload_flushed)) {
+        HUFF_TRACE2(payload_flushed, (packer.n_bits + 7) / 8, 0);
+    }
+    return huff_writer_close(bs, reader);
+}
 
-    BitStreamReader *encoded_file_stream =
-        bitstream_reader_new_offset(encoded_path, n_nodes);
-    FILE *out_file = fopen(decoded_path, "w");
+// Order-1 coding: each symbol is coded with the tree the byte before it
+// picks. The tables depend on which bytes follow which, which the symbol
+// set the cache is keyed by says little about, so they are built afresh.
+int huff_context_encode(HuffWorkspace *ws, FILE *in_file, int encoded_fd,
+                        long start, bool rle)
+{
+    if (ws->context_encode_tables == NULL) {
+        ws->context_encode_tables = malloc(sizeof(HuffContextTables));
+    }
+    HuffContextTables *tables = ws->context_encode_tables;
+    if (!huff_context_count(ws, &tables->model, in_file, rle) ||
+        ws->reader.error != 0) {
+        close(encoded_fd);
+        return huff_reader_status(&ws->reader);
+    }
+    if (HUFF_TRACE_ENABLED(histogram_done)) {
+        huff_trace_context_histogram_done(&tables->model, rle);
+    }
+    huff_context_tables_build(tables);
+    fseek(in_file, start, SEEK_SET);
+    return huff_context_write_codes(ws, tables, in_file, encoded_fd, rle);
+}
+
+// One tree for the whole input, from the cache when one fits.
+int huff_tree_encode(HuffWorkspace *ws, FILE *in_file, int encoded_fd,
+                     long start, bool rle)
+{
+    size_t characters[N_SYMBOLS] = {0};
+    huff_count_characters(ws, in_file, characters, rle);
+    if (ws->reader.error != 0) {
+        close(encoded_fd);
+        return huff_reader_status(&ws->reader);
+    }
+    // the original tree format writes a '\0' byte the way it writes a
+    // branch, and has no end of block to stop the padding of the last byte
+    // decoding as more of a lone symbol; both go in the wide one instead
+    size_t n_distinct = 0;
+    for (size_t i = 0; i < N_CHARACTERS; i++) {
+        n_distinct += characters[i] > 0;
+    }
+    if (!rle && (characters[0] > 0 || n_distinct == 1)) {
+        characters[RLE_EOB] = 1;
+    }
+    if (HUFF_TRACE_ENABLED(histogram_done)) {
+        huff_trace_histogram_done(characters, rle);
+    }
+    CodeCacheEntry *entry = NULL;
+    HuffEncodeTables *tables =
+        huff_encode_tables_get(ws, characters, rle, &entry);
+    int status = 0;
+    if (tables != NULL) {
+        fseek(in_file, start, SEEK_SET);
+        status = huff_write_codes(ws, tables, in_file, encoded_fd, rle);
+    } else {
+        close(encoded_fd);
+    }
+
+    if (entry != NULL) {
+        code_cache_release(ws->encode_cache, entry);
+    }
+    return status;
+}
+
+// The input is read twice, so in_fd has to be seekable. Both descriptors
+// are left open. context asks for order-1 coding, which falls back to one
+// tree if the workspace has no room for it. Returns 0, or -1 with errno set
+// if reading the input or writing the output failed.
+int huff_encode_fd(HuffWorkspace *ws, int in_fd, int out_fd, bool rle,
+                   bool context)
+{
+    FILE *in_file = fdopen(dup(in_fd), "r");
+    int encoded_fd = dup(out_fd);
+    long start = in_file ? ftell(in_file) : -1;
+    if (start < 0 || encoded_fd < 0) {
+        if (in_file) {
+            fclose(in_file);
+        }
+        if (encoded_fd >= 0) {
+            close(encoded_fd);
+        }
+        return -1;
+    }
+    setvbuf(in_file, ws->file_buffer, _IOFBF, HUFF_FILE_BUFFER_SIZE);
+    int status =
+        context && ws->context
+            ? huff_context_encode(ws, in_file, encoded_fd, start, rle)
+            : huff_tree_encode(ws, in_file, encoded_fd, start, rle);
+    int error = errno;
+    fclose(in_file);
+    errno = error;
+    return status;
+}
+
+int huff_encode_file(HuffWorkspace *ws, char *input_path, char *output_path,
+                     bool rle, bool context)
+{
+    int in_fd = open(input_path, O_RDONLY);
+    int out_fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    int status = -1;
+    if (in_fd >= 0 && out_fd >= 0) {
+        status = huff_encode_fd(ws, in_fd, out_fd, rle, context);
+    }
+    if (in_fd >= 0) {
+        close(in_fd);
+    }
+    if (out_fd >= 0) {
+        close(out_fd);
+    }
+    return status;
+}
+
+// Writes nothing more once a write has failed.
+void huff_output_write(HuffOutput *out, const u_int8_t *data, size_t size)
+{
+    while (out->error == 0 && size > 0) {
+        ssize_t written = write(out->fd, data, size);
+        if (written <= 0) {
+            out->error = written < 0 ? errno : EIO;
+            return;
+        }
+        data += written;
+        size -= written;
+        out->n_written += written;
+    }
+}
+
+void huff_output_flush(HuffOutput *out)
+{
+    huff_output_write(out, out->buffer, out->size);
+    out->size = 0;
+}
+
+// Writes a decoded symbol, expanding runs of the previous literal, and
+// returns false once the end-of-block symbol is reached or a write fails.
+bool huff_output_symbol(HuffOutput *out, int symbol)
+{
+    if (symbol == RLE_EOB) {
+        out->ended = true;
+        return false;
+    }
+    if (symbol < N_CHARACTERS) {
+        if (out->size == out->capacity) {
+            huff_output_flush(out);
+        }
+        out->buffer[out->size++] = symbol;
+        out->last = symbol;
+        return out->error == 0;
+    }
+
+    size_t run = RLE_RUN_LENGTH(symbol);
+    while (run > 0 && out->error == 0) {
+        if (out->size == out->capacity) {
+            huff_output_flush(out);
+        }
+        if (out->size == 0 && run >= out->capacity) {
+            memset(out->buffer, out->last, out->capacity);
+            for (; out->error == 0 && run >= out->capacity;
+                 run -= out->capacity) {
+                huff_output_write(out, out->buffer, out->capacity);
+            }
+            continue;
+        }
+        size_t n = out->capacity - out->size < run ? out->capacity - out->size
+                                                   : run;
+        memset(out->buffer + out->size, out->last, n);
+        out->size += n;
+        run -= n;
+    }
+    return out->error == 0;
+}
+
+void huff_decode_tree(HuffmanNode *tree, BitStreamReader *encoded_file_stream,
+                      HuffOutput *out)
+{
     int c;
     while (EOF != (c = h_tree_read_encoded_char(tree, encoded_file_stream))) {
-        fputc(c, out_file);
+        if (!huff_output_symbol(out, c)) {
+            return;
+        }
     }
-    h_node_free(tree);
-    bitstream_reader_close(encoded_file_stream);
-    fclose(out_file);
 }
 
-int main()
+// huff_decode_tree, with each code read from the tree the last byte
+// written picks.
+void huff_decode_context_tree(const HuffDecodeTables *tables,
+                              BitStreamReader *encoded_file_stream,
+                              HuffOutput *out)
+{
+    int c;
+    while (EOF != (c = h_tree_read_encoded_char(
+                       tables->trees[tables->map[out->last]],
+                       encoded_file_stream))) {
+        if (!huff_output_symbol(out, c)) {
+            return;
+        }
+    }
+}
+
+static size_t huff_decode_kernel(HuffWorkspace *ws,
+                                 const HuffDecodeTables *tables,
+                                 KernelBits *bits, bool final)
+{
+    if (tables->context) {
+        return ws->kernels->decode_context(tables->context_tables, bits, final,
+                                           ws->decoded, ws->io_size);
+    }
+    return ws->kernels->decode(tables->table, bits, final, ws->decoded,
+                               ws->io_size);
+}
+
+void huff_decode_table(HuffWorkspace *ws, const HuffDecodeTables *tables,
+                       FILE *encoded_file, HuffOutput *out)
+{
+    u_int8_t *buffer = ws->encoded;
+    KernelBits bits = {
+        .data = buffer,
+        .table = tables->context ? tables->map[0] : 0,
+    };
+    size_t size = 0;
+    bool final = false;
+    bool more = true;
+    while (more && !final) {
+        // keep the bytes the kernel has not finished with
+        size_t consumed = bits.pos / 8;
+        memmove(buffer, buffer + consumed, size - consumed);
+        size -= consumed;
+        bits.pos %= 8;
+        size += fread(buffer + size, 1, ws->io_size - size, encoded_file);
+        final = size < ws->io_size;
+        bits.n_bits = size * 8;
+
+        size_t n_symbols;
+        while (more &&
+               (n_symbols = huff_decode_kernel(ws, tables, &bits, final))) {
+            for (size_t i = 0; more && i < n_symbols; i++) {
+                more = huff_output_symbol(out, ws->decoded[i]);
+            }
+        }
+    }
+}
+
+// For the n_entries entries of one lookup table and the tree they were
+// filled from.
+void huff_trace_decode_table_built(const KernelTableEntry *entries,
+                                   size_t n_entries, HuffmanNode *tree,
+                                   size_t header_size)
+{
+    size_t n_slow = 0;
+    size_t n_symbols = 0;
+    for (size_t i = 0; i < n_entries; i++) {
+        n_slow += entries[i].n_symbols == 0;
+        n_symbols += entries[i].n_symbols;
+    }
+    HUFF_TRACE4(decode_table_built, header_size, (h_tree_size(tree) + 1) / 2,
+                n_slow, n_symbols * 1000 / n_entries);
+}
+
+// Builds the trees written in the header, and the lookup tables for them if
+// self has room for them.
+void huff_decode_tables_build(HuffDecodeTables *self, u_int8_t *header,
+                              size_t header_size)
+{
+    FILE *header_file = fmemopen(header, header_size, "r");
+    bool wide = header[0] == HUFF_HEADER_WIDE;
+    self->context = header[0] == HUFF_HEADER_CONTEXT;
+    self->wide = wide || self->context;
+    self->n_trees = 1;
+    if (self->context) {
+        fgetc(header_file);
+        self->n_trees = fgetc(header_file);
+        fread(self->map, 1, sizeof(self->map), header_file);
+    } else if (wide) {
+        fgetc(header_file);
+    }
+    for (size_t t = 0; t < self->n_trees; t++) {
+        self->trees[t] = wide || self->context
+                             ? h_tree_from_file_wide(NULL, header_file)
+                             : h_tree_from_file(NULL, header_file);
+    }
+    fclose(header_file);
+
+    if (self->context && self->context_tables != NULL) {
+        h_context_tables_build(self->context_tables, self->trees,
+                               self->n_trees, self->map);
+        // once for the table of each tree
+        for (size_t t = 0;
+             HUFF_TRACE_ENABLED(decode_table_built) && t < self->n_trees;
+             t++) {
+            huff_trace_decode_table_built(self->context_tables->entries[t],
+                                          KERNEL_CONTEXT_TABLE_SIZE,
+                                          self->trees[t], header_size);
+        }
+    } else if (!self->context && self->table != NULL) {
+        h_table_build(self->table, self->trees[0]);
+        if (HUFF_TRACE_ENABLED(decode_table_built)) {
+            huff_trace_decode_table_built(self->table->entries,
+                                          KERNEL_TABLE_SIZE, self->trees[0],
+                                          header_size);
+        }
+    }
+}
+
+void huff_decode_tables_free_trees(HuffDecodeTables *self)
+{
+    for (size_t t = 0; t < self->n_trees; t++) {
+        h_node_free(self->trees[t]);
+    }
+}
+
+void huff_decode_tables_free(void *data)
+{
+    HuffDecodeTables *self = data;
+    huff_decode_tables_free_trees(self);
+    free(self->table);
+    free(self->context_tables);
+    free(self);
+}
+
+// Copies the tree count and context map of a context-coded header to
+// header + 1, checking they are sound. Returns their size, or 0.
+static size_t huff_context_header_scan(FILE *encoded_file, u_int8_t *header)
+{
+    size_t size = 1 + N_CHARACTERS;
+    if (fread(header, 1, size, encoded_file) != size || header[0] == 0 ||
+        header[0] > HUFF_MAX_CONTEXT_TREES) {
+        return 0;
+    }
+    for (size_t c = 0; c < N_CHARACTERS; c++) {
+        if (header[1 + c] >= header[0]) {
+            return 0;
+        }
+    }
+    return size;
+}
+
+// Reads the header at the start of encoded_file and leaves the tables for
+// it in *tables, from the cache when an input with the same header came
+// before, or NULL for an empty input. Returns -1 with errno set to EINVAL,
+// and nothing built, if the header is cut short or is not one encoding
+// writes. A cache entry is left in *entry for the caller to release;
+// without one the caller frees the trees.
+int huff_decode_tables_get(HuffWorkspace *ws, FILE *encoded_file,
+                           HuffDecodeMode mode, HuffDecodeTables **tables,
+                           CodeCacheEntry **entry)
+{
+    u_int8_t header[HUFF_MAX_CONTEXT_HEADER_SIZE];
+    size_t header_size = 0;
+    size_t n_trees = 1;
+    *tables = NULL;
+    int c = fgetc(encoded_file);
+    if (c == EOF) {
+        return 0;
+    }
+    bool context = c == HUFF_HEADER_CONTEXT;
+    bool wide = c == HUFF_HEADER_WIDE || context;
+    if (!wide && c != HUFF_HEADER_BRANCH) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (wide) {
+        header[header_size++] = c;
+    } else {
+        ungetc(c, encoded_file);
+    }
+    if (context) {
+        size_t size = huff_context_header_scan(encoded_file, header + 1);
+        if (size == 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        n_trees = header[1];
+        header_size += size;
+    }
+    for (size_t t = 0; t < n_trees; t++) {
+        // wide trees can hold run lengths and the end of block as well;
+        // bounding the leaves bounds the nodes the decode tables flatten
+        // them into
+        size_t tree_size = h_tree_scan(
+            encoded_file, wide, header + header_size,
+            sizeof(header) - header_size, wide ? N_SYMBOLS : N_CHARACTERS,
+            HUFF_MAX_CODE_LENGTH);
+        // a lone leaf takes no bits, so it could be read forever; encoding
+        // never writes one
+        if (tree_size == 0 || tree_size == (wide ? 3 : 1)) {
+            errno = EINVAL;
+            return -1;
+        }
+        header_size += tree_size;
+    }
+
+    if (ws->decode_cache == NULL) {
+        // the workspace has no tables when the plan could not fit them
+        HuffDecodeTables *own = &ws->decode_tables;
+        bool with_tables = mode == HUFF_DECODE_TABLE && ws->table != NULL;
+        if (with_tables && context && ws->context_tables == NULL) {
+            ws->context_tables = malloc(sizeof(*ws->context_tables));
+        }
+        own->table = with_tables ? ws->table : NULL;
+        own->context_tables = with_tables ? ws->context_tables : NULL;
+        huff_decode_tables_build(own, header, header_size);
+        *tables = own;
+        return 0;
+    }
+
+    *entry = code_cache_get(ws->decode_cache, header, header_size);
+    if (*entry == NULL) {
+        // cached tables serve either mode, so they always get the table
+        HuffDecodeTables *built = malloc(sizeof(*built));
+        built->table = context ? NULL : malloc(sizeof(*built->table));
+        built->context_tables =
+            context ? malloc(sizeof(*built->context_tables)) : NULL;
+        huff_decode_tables_build(built, header, header_size);
+        *entry =
+            code_cache_put(ws->decode_cache, header, header_size, built);
+    }
+    *tables = code_cache_value(*entry);
+    return 0;
+}
+
+CodeCache *huff_decode_cache_new(size_t capacity)
+{
+    return code_cache_new(capacity, huff_decode_tables_free);
+}
+
+// Both descriptors are left open. Returns 0, or -1 with errno set if the
+// header is not one encoding writes, the input ends before its end-of-block
+// symbol, or reading or writing failed.
+int huff_decode_fd(HuffWorkspace *ws, int in_fd, int out_fd,
+                   HuffDecodeMode mode)
+{
+    FILE *encoded_file = fdopen(dup(in_fd), "r");
+    if (encoded_file == NULL) {
+        return -1;
+    }
+    setvbuf(encoded_file, ws->file_buffer, _IOFBF, HUFF_FILE_BUFFER_SIZE);
+    off_t start = 0;
+    if (HUFF_TRACE_ENABLED(decode_finished)) {
+        start = lseek(in_fd, 0, SEEK_CUR);
+    }
+    CodeCacheEntry *entry = NULL;
+    HuffDecodeTables *tables;
+    if (huff_decode_tables_get(ws, encoded_file, mode, &tables, &entry) < 0) {
+        fclose(encoded_file);
+        return -1;
+    }
+
+    HuffOutput *out = &ws->output;
+    out->fd = out_fd;
+    out->last = 0;
+    out->size = 0;
+    out->n_written = 0;
+    out->ended = false;
+    out->error = 0;
+    int read_error = 0;
+    // no tree is an empty input, which has nothing to read back
+    bool empty = tables == NULL;
+    bool with_table = false;
+    if (!empty && mode == HUFF_DECODE_TABLE) {
+        with_table = tables->context ? tables->context_tables != NULL
+                                     : tables->table != NULL;
+    }
+    if (!empty && with_table) {
+        huff_decode_table(ws, tables, encoded_file, out);
+        read_error = ferror(encoded_file) ? EIO : 0;
+    } else if (!empty) {
+        int encoded_fd = dup(in_fd);
+        lseek(encoded_fd, ftell(encoded_file), SEEK_SET);
+        BitStreamReader *encoded_file_stream =
+            bitstream_reader_new_full(encoded_fd, ws->io_size);
+        if (tables->context) {
+            huff_decode_context_tree(tables, encoded_file_stream, out);
+        } else {
+            huff_decode_tree(tables->trees[0], encoded_file_stream, out);
+        }
+        if (bitstream_reader_close(encoded_file_stream) < 0) {
+            read_error = errno;
+        }
+    }
+    huff_output_flush(out);
+    if (HUFF_TRACE_ENABLED(decode_finished)) {
+        HUFF_TRACE3(decode_finished, lseek(in_fd, 0, SEEK_CUR) - start,
+                    out->n_written, mode == HUFF_DECODE_TABLE);
+    }
+    // a failed write stops decoding, so it explains a missing end of
+    // block before the input does
+    int error = out->error != 0 ? out->error : read_error;
+    if (error == 0 && !empty && tables->wide && !out->ended) {
+        error = EINVAL;
+    }
+    fclose(encoded_file);
+    if (entry != NULL) {
+        code_cache_release(ws->decode_cache, entry);
+    } else if (tables != NULL) {
+        huff_decode_tables_free_trees(tables);
+    }
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+int huff_decode_file(HuffWorkspace *ws, char *encoded_path,
+                     char *decoded_path, HuffDecodeMode mode)
+{
+    int in_fd = open(encoded_path, O_RDONLY);
+    int out_fd = open(decoded_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    int status = -1;
+    if (in_fd >= 0 && out_fd >= 0) {
+        status = huff_decode_fd(ws, in_fd, out_fd, mode);
+    }
+    if (in_fd >= 0) {
+        close(in_fd);
+    }
+    if (out_fd >= 0) {
+        close(out_fd);
+    }
+    return status;
+}
+
+// What running to plan takes at most: a workspace and a stack for each
+// worker, and both caches full.
+size_t huff_plan_bytes(const HuffPlan *plan)
+{
+    size_t bytes = plan->n_workers *
+                   (huff_workspace_bytes(plan->io_size, plan->table,
+                                         plan->context) +
+                    plan->stack_size);
+    if (plan->n_cache_entries > 0) {
+        size_t table_size = sizeof(KernelDecodeTable) >
+                                    sizeof(KernelContextTables)
+                                ? sizeof(KernelDecodeTable)
+                                : sizeof(KernelContextTables);
+        size_t decode_value = sizeof(HuffDecodeTables) + table_size +
+                              HUFF_MAX_CONTEXT_TREES * h_tree_bytes(N_SYMBOLS);
+        bytes += code_cache_bytes(plan->n_cache_entries, HUFF_SYMBOL_SET_SIZE,
+                                  sizeof(HuffEncodeTables));
+        bytes += code_cache_bytes(plan->n_cache_entries,
+                                  HUFF_MAX_CONTEXT_HEADER_SIZE, decode_value);
+    }
+    return bytes;
+}
+
+// Cuts the wanted plan down to fit in budget bytes, 0 being no limit. The
+// decode tables come first, then order-1 encoding, then workers, then
+// blocks and cached tables.
+// Blocks past HUFF_IO_SIZE only cost time in cache misses, so a budget
+// never grows them. Returns false, with the smallest plan in *plan, if even
+// that does not fit.
+bool huff_plan_fit(HuffPlan *plan, size_t budget)
+{
+    if (budget == 0) {
+        return true;
+    }
+    HuffPlan wanted = *plan;
+    *plan = (HuffPlan){
+        .io_size = HUFF_MIN_IO_SIZE,
+        .n_workers = 1,
+        .stack_size = wanted.stack_size,
+    };
+    if (huff_plan_bytes(plan) > budget) {
+        return false;
+    }
+    plan->table = wanted.table;
+    if (huff_plan_bytes(plan) > budget) {
+        plan->table = false;
+    }
+    plan->context = wanted.context;
+    if (huff_plan_bytes(plan) > budget) {
+        plan->context = false;
+    }
+    while (plan->n_workers < wanted.n_workers) {
+        plan->n_workers += 1;
+        if (huff_plan_bytes(plan) > budget) {
+            plan->n_workers -= 1;
+            break;
+        }
+    }
+    while (plan->io_size < wanted.io_size) {
+        plan->io_size *= 2;
+        if (huff_plan_bytes(plan) > budget) {
+            plan->io_size /= 2;
+            break;
+        }
+    }
+    while (plan->n_cache_entries < wanted.n_cache_entries) {
+        plan->n_cache_entries += 1;
+        if (huff_plan_bytes(plan) > budget) {
+            plan->n_cache_entries -= 1;
+            break;
+        }
+    }
+    return true;
+}
+
+// Says on stderr what the budget cost against the wanted plan, if anything.
+void huff_plan_report(const HuffPlan *plan, const HuffPlan *wanted,
+                      size_t budget)
 {
-#if 1
-    huff_encode_file("mobydick.txt", "mobydick.txt.huff");
-    huff_decode_file("mobydick.txt.huff", "mobydick.2.txt");
-#endif
-#if 0
-    huff_encode_file("test.txt", "test.txt.huff");
-    huff_decode_file("test.txt.huff", "test.2.txt");
-#endif
+    bool smaller_blocks = plan->io_size < wanted->io_size;
+    bool no_table = wanted->table && !plan->table;
+    bool no_context = wanted->context && !plan->context;
+    bool fewer_workers = plan->n_workers < wanted->n_workers;
+    bool fewer_tables = plan->n_cache_entries < wanted->n_cache_entries;
+    if (!smaller_blocks && !no_table && !no_context && !fewer_workers &&
+        !fewer_tables) {
+        return;
+    }
+    fprintf(stderr, "memory budget of %zu bytes, %zu planned:\n", budget,
+            huff_plan_bytes(plan));
+    if (smaller_blocks) {
+        fprintf(stderr, "  %zu byte blocks instead of %zu\n", plan->io_size,
+                wanted->io_size);
+    }
+    if (no_table) {
+        fprintf(stderr, "  decoding walks the tree instead of a table\n");
+    }
+    if (no_context) {
+        fprintf(stderr, "  encoding with one tree instead of one per "
+                        "context\n");
+    }
+    if (fewer_workers) {
+        fprintf(stderr, "  %zu workers instead of %zu\n", plan->n_workers,
+                wanted->n_workers);
+    }
+    if (fewer_tables) {
+        fprintf(stderr, "  %zu cached code tables instead of %zu\n",
+                plan->n_cache_entries, wanted->n_cache_entries);
+    }
+}
+
+// A byte count with an optional K, M or G suffix, or 0 if it is not one.
+size_t huff_parse_bytes(const char *text)
+{
+    char *end;
+    size_t bytes = strtoul(text, &end, 10);
+    switch (*end) {
+    case 'G':
+        bytes *= 1024;
+        // fall through
+    case 'M':
+        bytes *= 1024;
+        // fall through
+    case 'K':
+        bytes *= 1024;
+        end += 1;
+        break;
+    }
+    return *end == '\0' ? bytes : 0;
+}
+
+void huff_usage(char *program)
+{
+    fprintf(stderr,
+            "usage: %s [-r] [-C] [-D tree|table] [-m bytes] [-K kernels] "
+            "encode|decode <in> <out>\n"
+            "       %s [-j workers] [-c entries] [-m bytes] [-K kernels] "
+            "serve <socket>\n"
+            "  -r  run-length encode before the Huffman stage\n"
+            "  -C  code each symbol with a tree picked by the byte before it\n"
+            "  -m  memory budget (K, M or G suffix), which picks block size,\n"
+            "      decode tables, -C, workers and cached tables to fit\n"
+            "  -j  worker threads for serve, one per CPU by default\n"
+            "  -c  code tables serve caches for each direction (0 for none)\n"
+            "  -K  kernel set to use instead of the best the CPU supports\n"
+            "      (also $HUFF_KERNEL): ",
+            program, program);
+    kernels_print(stderr);
+}
+
+int main(int argc, char *argv[])
+{
+    HuffDecodeMode decode_mode = HUFF_DECODE_TREE;
+    bool rle = false;
+    bool context = false;
+    char *kernel_name = NULL;
+    size_t n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t n_cache_entries = HUFF_CACHE_ENTRIES;
+    size_t budget = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "rCD:K:j:c:m:")) != -1) {
+        switch (opt) {
+        case 'r':
+            rle = true;
+            break;
+        case 'C':
+            context = true;
+            break;
+        case 'D':
+            if (strcmp(optarg, "tree") == 0) {
+                decode_mode = HUFF_DECODE_TREE;
+            } else if (strcmp(optarg, "table") == 0) {
+                decode_mode = HUFF_DECODE_TABLE;
+            } else {
+                huff_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'K':
+            kernel_name = optarg;
+            break;
+        case 'j':
+            n_workers = strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            n_cache_entries = strtoul(optarg, NULL, 10);
+            break;
+        case 'm':
+            budget = huff_parse_bytes(optarg);
+            if (budget == 0) {
+                huff_usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            huff_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    const Kernels *kernels = kernels_get(kernel_name);
+    if (kernels == NULL || n_workers == 0) {
+        huff_usage(argv[0]);
+        return 1;
+    }
+
+    bool serve = argc - optind == 2 && strcmp(argv[optind], "serve") == 0;
+    // with no command, mobydick.txt is encoded and decoded
+    bool encode = optind == argc ||
+                  (argc - optind == 3 && strcmp(argv[optind], "encode") == 0);
+    bool decode = optind == argc ||
+                  (argc - optind == 3 && strcmp(argv[optind], "decode") == 0);
+    // only decoding builds tables, and only encoding codes per context
+    HuffPlan wanted = {
+        .io_size = HUFF_IO_SIZE,
+        .table = decode && decode_mode == HUFF_DECODE_TABLE,
+        .context = encode && context,
+        .n_workers = 1,
+    };
+    if (serve) {
+        // requests pick their own modes
+        wanted.table = true;
+        wanted.context = true;
+        wanted.n_workers = n_workers;
+        wanted.stack_size = HUFF_WORKER_STACK_SIZE;
+        wanted.n_cache_entries = n_cache_entries;
+    }
+    HuffPlan plan = wanted;
+    if (!huff_plan_fit(&plan, budget)) {
+        fprintf(stderr, "%s: a memory budget of %zu bytes is under the %zu "
+                "needed\n", argv[0], budget, huff_plan_bytes(&plan));
+        return 1;
+    }
+    huff_plan_report(&plan, &wanted, budget);
+
+    if (serve) {
+        int status = huff_server_run(argv[optind + 1], &plan, kernels);
+        return status ? 1 : 0;
+    }
+
+    HuffWorkspace *ws = huff_workspace_new(kernels, &plan, NULL, NULL);
+    int status = 0;
+    if (optind == argc) {
+        status = huff_encode_file(ws, "mobydick.txt", "mobydick.txt.huff", rle,
+                                  context);
+        status = status ? status
+                        : huff_decode_file(ws, "mobydick.txt.huff",
+                                           "mobydick.2.txt", decode_mode);
+    } else if (encode) {
+        status = huff_encode_file(ws, argv[optind + 1], argv[optind + 2], rle,
+                                  context);
+    } else if (decode) {
+        status = huff_decode_file(ws, argv[optind + 1], argv[optind + 2],
+                                  decode_mode);
+    } else {
+        huff_usage(argv[0]);
+        status = 1;
+    }
+    huff_workspace_free(ws);
+    if (status < 0) {
+        perror(argv[0]);
+    }
+    return status ? 1 : 0;
 }
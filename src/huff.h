@@ -0,0 +1,43 @@
+#pragma once
+#include <stdbool.h>
+
+#include "code_cache.h"
+#include "kernels.h"
+
+typedef struct HuffWorkspace_s HuffWorkspace;
+typedef enum HuffDecodeMode {
+    HUFF_DECODE_TREE,
+    HUFF_DECODE_TABLE,
+} HuffDecodeMode;
+
+// What a budget leaves room for. n_workers and stack_size only matter to
+// the server.
+typedef struct HuffPlan {
+    size_t io_size;
+    bool table;
+    bool context;
+    size_t n_workers;
+    size_t stack_size;
+    size_t n_cache_entries;
+} HuffPlan;
+
+size_t huff_plan_bytes(const HuffPlan *plan);
+bool huff_plan_fit(HuffPlan *plan, size_t budget);
+void huff_plan_report(const HuffPlan *plan, const HuffPlan *wanted,
+                      size_t budget);
+
+HuffWorkspace *huff_workspace_new(const Kernels *kernels, const HuffPlan *plan,
+                                  CodeCache *encode_cache,
+                                  CodeCache *decode_cache);
+void huff_workspace_free(HuffWorkspace *self);
+CodeCache *huff_encode_cache_new(size_t capacity);
+CodeCache *huff_decode_cache_new(size_t capacity);
+
+int huff_encode_fd(HuffWorkspace *ws, int in_fd, int out_fd, bool rle,
+                   bool context);
+int huff_encode_file(HuffWorkspace *ws, char *input_path, char *output_path,
+                     bool rle, bool context);
+int huff_decode_fd(HuffWorkspace *ws, int in_fd, int out_fd,
+                   HuffDecodeMode mode);
+int huff_decode_file(HuffWorkspace *ws, char *encoded_path,
+                     char *decoded_path, HuffDecodeMode mode);
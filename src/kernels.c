@@ -0,0 +1,88 @@
+#include "kernels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KERNEL_DECLARE(suffix)                                                 \
+    void kernel_histogram_##suffix(const u_int16_t *symbols,                   \
+                                   size_t n_symbols, size_t *counts,           \
+                                   size_t n_counts);                           \
+    size_t kernel_pack_##suffix(KernelPacker *packer,                          \
+                                const KernelCode *codes,                       \
+                                const u_int16_t *symbols, size_t n_symbols,    \
+                                u_int8_t *out);                                \
+    size_t kernel_decode_##suffix(const KernelDecodeTable *table,              \
+                                  KernelBits *bits, bool final,                \
+                                  u_int16_t *symbols, size_t max_symbols);     \
+    size_t kernel_pack_context_##suffix(                                       \
+        KernelPacker *packer, const u_int8_t *map, const KernelCode *codes,    \
+        size_t n_codes, const u_int16_t *symbols, size_t n_symbols,            \
+        u_int8_t *out);                                                        \
+    size_t kernel_decode_context_##suffix(                                     \
+        const KernelContextTables *tables, KernelBits *bits, bool final,       \
+        u_int16_t *symbols, size_t max_symbols)
+
+KERNEL_DECLARE(scalar);
+
+static bool kernels_scalar_supported(void) { return true; }
+
+#ifdef HUFF_HAVE_AVX2
+KERNEL_DECLARE(avx2);
+
+static bool kernels_avx2_supported(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2");
+}
+#endif
+
+// in order of preference
+static const Kernels KERNELS[] = {
+#ifdef HUFF_HAVE_AVX2
+    {"avx2", kernels_avx2_supported, kernel_histogram_avx2, kernel_pack_avx2,
+     kernel_decode_avx2, kernel_pack_context_avx2, kernel_decode_context_avx2},
+#endif
+    {"scalar", kernels_scalar_supported, kernel_histogram_scalar,
+     kernel_pack_scalar, kernel_decode_scalar, kernel_pack_context_scalar,
+     kernel_decode_context_scalar},
+};
+#define N_KERNELS (sizeof(KERNELS) / sizeof(*KERNELS))
+
+static const Kernels *kernels_best(void)
+{
+    static const Kernels *best = NULL;
+    for (size_t i = 0; best == NULL && i < N_KERNELS; i++) {
+        if (KERNELS[i].supported()) {
+            best = &KERNELS[i];
+        }
+    }
+    return best;
+}
+
+// Picks the named kernel set, or the one in $HUFF_KERNEL, or the best the
+// CPU supports. Returns NULL for unknown or unsupported names.
+const Kernels *kernels_get(const char *name)
+{
+    if (name == NULL) {
+        name = getenv("HUFF_KERNEL");
+    }
+    if (name == NULL) {
+        return kernels_best();
+    }
+
+    for (size_t i = 0; i < N_KERNELS; i++) {
+        if (strcmp(KERNELS[i].name, name) == 0) {
+            return KERNELS[i].supported() ? &KERNELS[i] : NULL;
+        }
+    }
+    return NULL;
+}
+
+void kernels_print(FILE *stream)
+{
+    for (size_t i = 0; i < N_KERNELS; i++) {
+        fprintf(stream, "%s%s%s", i > 0 ? ", " : "", KERNELS[i].name,
+                KERNELS[i].supported() ? "" : " (unsupported)");
+    }
+    fprintf(stream, "\n");
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#define KERNEL_TABLE_BITS 12
+#define KERNEL_TABLE_SIZE (1 << KERNEL_TABLE_BITS)
+#define KERNEL_TABLE_MAX_SYMBOLS 3
+#define KERNEL_MAX_SYMBOLS 512
+#define KERNEL_MAX_NODES (2 * KERNEL_MAX_SYMBOLS)
+// node references with this bit set are leaves holding the symbol itself
+#define KERNEL_LEAF 0x8000
+// symbols below this are bytes, and pick the context of the next one; the
+// rest (run lengths, end of block) leave it as it is
+#define KERNEL_N_LITERALS 256
+// smaller than KERNEL_TABLE_BITS so all the context tables stay in cache
+#define KERNEL_CONTEXT_TABLE_BITS 10
+#define KERNEL_CONTEXT_TABLE_SIZE (1 << KERNEL_CONTEXT_TABLE_BITS)
+#define KERNEL_MAX_CONTEXT_TABLES 8
+
+typedef struct KernelCode {
+    u_int32_t bits;
+    u_int8_t length;
+} KernelCode;
+
+typedef struct KernelTableEntry {
+    u_int16_t symbols[KERNEL_TABLE_MAX_SYMBOLS];
+    u_int8_t n_symbols;
+    u_int8_t n_bits;
+    // n_symbols == 0: the branch the first KERNEL_TABLE_BITS bits lead to;
+    // otherwise, in context tables, the table the next code is in
+    u_int16_t node;
+} KernelTableEntry;
+
+typedef struct KernelNode {
+    u_int16_t child[2];
+} KernelNode;
+
+typedef struct KernelDecodeTable {
+    KernelTableEntry entries[KERNEL_TABLE_SIZE];
+    KernelNode nodes[KERNEL_MAX_NODES];
+    u_int16_t root;
+} KernelDecodeTable;
+
+// Order-1 decoding: map takes the last byte decoded to the table the next
+// code is in. An entry reads on into the tables its own bytes pick, so one
+// lookup still gives several symbols; the trees of all the tables share
+// nodes.
+typedef struct KernelContextTables {
+    u_int8_t map[KERNEL_N_LITERALS];
+    u_int16_t roots[KERNEL_MAX_CONTEXT_TABLES];
+    KernelTableEntry entries[KERNEL_MAX_CONTEXT_TABLES]
+                            [KERNEL_CONTEXT_TABLE_SIZE];
+    KernelNode nodes[KERNEL_MAX_CONTEXT_TABLES * KERNEL_MAX_SYMBOLS];
+} KernelContextTables;
+
+// pack: codes not yet written out, in the low n_bits of bits, and for
+// pack_context the table the next code comes from
+typedef struct KernelPacker {
+    u_int64_t bits;
+    u_int8_t n_bits;
+    u_int8_t table;
+} KernelPacker;
+
+// decode: a byte buffer holding n_bits bits, read up to pos, and for
+// decode_context the table the next code is in
+typedef struct KernelBits {
+    const u_int8_t *data;
+    size_t n_bits;
+    size_t pos;
+    u_int8_t table;
+} KernelBits;
+
+typedef void (*KernelHistogramFunc)(const u_int16_t *symbols,
+                                    size_t n_symbols, size_t *counts,
+                                    size_t n_counts);
+typedef size_t (*KernelPackFunc)(KernelPacker *packer, const KernelCode *codes,
+                                 const u_int16_t *symbols, size_t n_symbols,
+                                 u_int8_t *out);
+typedef size_t (*KernelDecodeFunc)(const KernelDecodeTable *table,
+                                   KernelBits *bits, bool final,
+                                   u_int16_t *symbols, size_t max_symbols);
+// codes holds n_codes codes for each table map can pick
+typedef size_t (*KernelPackContextFunc)(KernelPacker *packer,
+                                        const u_int8_t *map,
+                                        const KernelCode *codes,
+                                        size_t n_codes,
+                                        const u_int16_t *symbols,
+                                        size_t n_symbols, u_int8_t *out);
+typedef size_t (*KernelDecodeContextFunc)(const KernelContextTables *tables,
+                                          KernelBits *bits, bool final,
+                                          u_int16_t *symbols,
+                                          size_t max_symbols);
+
+typedef struct Kernels {
+    const char *name;
+    bool (*supported)(void);
+    KernelHistogramFunc histogram;
+    KernelPackFunc pack;
+    KernelDecodeFunc decode;
+    KernelPackContextFunc pack_context;
+    KernelDecodeContextFunc decode_context;
+} Kernels;
+
+const Kernels *kernels_get(const char *name);
+void kernels_print(FILE *stream);
@@ -0,0 +1,4 @@
+// Built with -mavx2 -mbmi2 (see meson.build) and only called once
+// kernels_get has checked the CPU supports both.
+#define KERNEL_FN(name) name##_avx2
+#include "kernels_template.h"
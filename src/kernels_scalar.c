@@ -0,0 +1,2 @@
+#define KERNEL_FN(name) name##_scalar
+#include "kernels_template.h"
@@ -0,0 +1,228 @@
+// Kernel bodies shared by every kernel set. Each kernels_*.c defines
+// KERNEL_FN to give the functions its own suffix and is built with the
+// target flags of that set, so one source serves all of them.
+#include "kernels.h"
+#include <string.h>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#define KERNEL_LOW_BITS(x, n) _bzhi_u64((x), (n))
+#else
+#define KERNEL_LOW_BITS(x, n) ((x) & (((u_int64_t)1 << (n)) - 1))
+#endif
+
+static inline u_int64_t KERNEL_FN(load_be64)(const u_int8_t *data)
+{
+    u_int64_t word;
+    memcpy(&word, data, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+// Counts into four tables so consecutive equal symbols don't wait on each
+// other's increments. Takes fewer than 2^32 symbols per call.
+void KERNEL_FN(kernel_histogram)(const u_int16_t *symbols, size_t n_symbols,
+                                 size_t *counts, size_t n_counts)
+{
+    u_int32_t partial[4][KERNEL_MAX_SYMBOLS] = {{0}};
+    size_t i = 0;
+    for (; i + 4 <= n_symbols; i += 4) {
+        partial[0][symbols[i]] += 1;
+        partial[1][symbols[i + 1]] += 1;
+        partial[2][symbols[i + 2]] += 1;
+        partial[3][symbols[i + 3]] += 1;
+    }
+    for (; i < n_symbols; i++) {
+        partial[0][symbols[i]] += 1;
+    }
+    for (size_t s = 0; s < n_counts; s++) {
+        counts[s] += (size_t)partial[0][s] + partial[1][s] + partial[2][s] +
+                     partial[3][s];
+    }
+}
+
+// Appends the codes of the symbols MSB first, writing whole 32-bit words to
+// out (4 bytes per symbol at most) and keeping the rest in the packer.
+size_t KERNEL_FN(kernel_pack)(KernelPacker *packer, const KernelCode *codes,
+                              const u_int16_t *symbols, size_t n_symbols,
+                              u_int8_t *out)
+{
+    u_int64_t bits = packer->bits;
+    u_int8_t n_bits = packer->n_bits;
+    size_t n_out = 0;
+    for (size_t i = 0; i < n_symbols; i++) {
+        KernelCode code = codes[symbols[i]];
+        bits = bits << code.length | code.bits;
+        n_bits += code.length;
+        if (n_bits >= 32) {
+            n_bits -= 32;
+            u_int32_t word = bits >> n_bits;
+            out[n_out] = word >> 24;
+            out[n_out + 1] = word >> 16;
+            out[n_out + 2] = word >> 8;
+            out[n_out + 3] = word;
+            n_out += 4;
+        }
+    }
+    packer->bits = KERNEL_LOW_BITS(bits, n_bits);
+    packer->n_bits = n_bits;
+    return n_out;
+}
+
+// Decodes while a whole 64-bit load fits in the buffer, and bit by bit to
+// the end of it once `final` says no more data follows. Stops early when
+// `symbols` has no room for another table entry.
+size_t KERNEL_FN(kernel_decode)(const KernelDecodeTable *table,
+                                KernelBits *bits, bool final,
+                                u_int16_t *symbols, size_t max_symbols)
+{
+    size_t pos = bits->pos;
+    size_t n_out = 0;
+    while (pos + 64 <= bits->n_bits &&
+           n_out + KERNEL_TABLE_MAX_SYMBOLS <= max_symbols) {
+        u_int64_t window = KERNEL_FN(load_be64)(bits->data + pos / 8)
+                           << (pos % 8);
+        const KernelTableEntry *entry =
+            &table->entries[window >> (64 - KERNEL_TABLE_BITS)];
+        if (entry->n_symbols > 0) {
+            memcpy(symbols + n_out, entry->symbols, sizeof(entry->symbols));
+            n_out += entry->n_symbols;
+            pos += entry->n_bits;
+            continue;
+        }
+
+        u_int16_t node = entry->node;
+        u_int8_t used = KERNEL_TABLE_BITS;
+        while (!(node & KERNEL_LEAF)) {
+            node = table->nodes[node].child[(window >> (63 - used)) & 0x1];
+            used += 1;
+        }
+        symbols[n_out++] = node & ~KERNEL_LEAF;
+        pos += used;
+    }
+
+    if (final) {
+        u_int16_t node = table->root;
+        size_t start = pos;
+        while (start < bits->n_bits && n_out < max_symbols) {
+            u_int8_t byte = bits->data[pos / 8];
+            node = table->nodes[node].child[(byte >> (7 - pos % 8)) & 0x1];
+            pos += 1;
+            if (node & KERNEL_LEAF) {
+                symbols[n_out++] = node & ~KERNEL_LEAF;
+                node = table->root;
+                start = pos;
+            } else if (pos == bits->n_bits) {
+                // the padding ran out in the middle of a code
+                start = pos;
+            }
+        }
+        pos = start;
+    }
+
+    bits->pos = pos;
+    return n_out;
+}
+
+// pack, with each code taken from the table the byte before it picks.
+size_t KERNEL_FN(kernel_pack_context)(KernelPacker *packer,
+                                      const u_int8_t *map,
+                                      const KernelCode *codes, size_t n_codes,
+                                      const u_int16_t *symbols,
+                                      size_t n_symbols, u_int8_t *out)
+{
+    u_int64_t bits = packer->bits;
+    u_int8_t n_bits = packer->n_bits;
+    const KernelCode *table = codes + packer->table * n_codes;
+    size_t n_out = 0;
+    for (size_t i = 0; i < n_symbols; i++) {
+        u_int16_t symbol = symbols[i];
+        KernelCode code = table[symbol];
+        bits = bits << code.length | code.bits;
+        n_bits += code.length;
+        if (symbol < KERNEL_N_LITERALS) {
+            table = codes + map[symbol] * n_codes;
+        }
+        if (n_bits >= 32) {
+            n_bits -= 32;
+            u_int32_t word = bits >> n_bits;
+            out[n_out] = word >> 24;
+            out[n_out + 1] = word >> 16;
+            out[n_out + 2] = word >> 8;
+            out[n_out + 3] = word;
+            n_out += 4;
+        }
+    }
+    packer->bits = KERNEL_LOW_BITS(bits, n_bits);
+    packer->n_bits = n_bits;
+    packer->table = (table - codes) / n_codes;
+    return n_out;
+}
+
+// decode, through the table the last byte decoded picks. Every tree has
+// two leaves at least, so each code takes a bit or more.
+size_t KERNEL_FN(kernel_decode_context)(const KernelContextTables *tables,
+                                        KernelBits *bits, bool final,
+                                        u_int16_t *symbols,
+                                        size_t max_symbols)
+{
+    size_t pos = bits->pos;
+    u_int16_t table = bits->table;
+    size_t n_out = 0;
+    while (pos + 64 <= bits->n_bits &&
+           n_out + KERNEL_TABLE_MAX_SYMBOLS <= max_symbols) {
+        u_int64_t window = KERNEL_FN(load_be64)(bits->data + pos / 8)
+                           << (pos % 8);
+        const KernelTableEntry *entry =
+            &tables->entries[table][window >> (64 - KERNEL_CONTEXT_TABLE_BITS)];
+        if (entry->n_symbols > 0) {
+            memcpy(symbols + n_out, entry->symbols, sizeof(entry->symbols));
+            n_out += entry->n_symbols;
+            pos += entry->n_bits;
+            table = entry->node;
+            continue;
+        }
+
+        u_int16_t node = entry->node;
+        u_int8_t used = KERNEL_CONTEXT_TABLE_BITS;
+        while (!(node & KERNEL_LEAF)) {
+            node = tables->nodes[node].child[(window >> (63 - used)) & 0x1];
+            used += 1;
+        }
+        u_int16_t symbol = node & ~KERNEL_LEAF;
+        symbols[n_out++] = symbol;
+        pos += used;
+        if (symbol < KERNEL_N_LITERALS) {
+            table = tables->map[symbol];
+        }
+    }
+
+    if (final) {
+        u_int16_t node = tables->roots[table];
+        size_t start = pos;
+        while (start < bits->n_bits && n_out < max_symbols) {
+            u_int8_t byte = bits->data[pos / 8];
+            node = tables->nodes[node].child[(byte >> (7 - pos % 8)) & 0x1];
+            pos += 1;
+            if (node & KERNEL_LEAF) {
+                u_int16_t symbol = node & ~KERNEL_LEAF;
+                symbols[n_out++] = symbol;
+                if (symbol < KERNEL_N_LITERALS) {
+                    table = tables->map[symbol];
+                }
+                node = tables->roots[table];
+                start = pos;
+            } else if (pos == bits->n_bits) {
+                // the padding ran out in the middle of a code
+                start = pos;
+            }
+        }
+        pos = start;
+    }
+
+    bits->pos = pos;
+    bits->table = table;
+    return n_out;
+}
@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <sys/types.h>
+
+#define RLE_EOB 256
+#define RLE_RUN_SYMBOL 257
+#define RLE_N_RUN_SYMBOLS 48
+#define RLE_MAX_RUN (((size_t)1 << RLE_N_RUN_SYMBOLS) - 1)
+// shorter runs are cheaper to send as plain literals
+#define RLE_MIN_RUN 4
+
+typedef struct Rle {
+    int last;
+    size_t run;
+} Rle;
+
+// Drops any run left by an input that stopped before rle_finish.
+void rle_reset(Rle *self)
+{
+    self->last = -1;
+    self->run = 0;
+}
+
+Rle *rle_new(void)
+{
+    Rle *self = malloc(sizeof(*self));
+    rle_reset(self);
+    return self;
+}
+
+void rle_free(Rle *self) { free(self); }
+
+static size_t rle_flush_run(Rle *self, u_int16_t *symbols)
+{
+    size_t n_symbols = 0;
+    if (self->run < RLE_MIN_RUN) {
+        for (size_t i = 0; i < self->run; i++) {
+            symbols[n_symbols++] = self->last;
+        }
+    } else {
+        for (int k = RLE_N_RUN_SYMBOLS - 1; k >= 0; k--) {
+            if ((self->run >> k) & 0x1) {
+                symbols[n_symbols++] = RLE_RUN_SYMBOL + k;
+            }
+        }
+    }
+    self->run = 0;
+    return n_symbols;
+}
+
+size_t rle_encode(Rle *self, const u_int8_t *data, size_t size,
+                  u_int16_t *symbols)
+{
+    size_t n_symbols = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] == self->last && self->run < RLE_MAX_RUN) {
+            self->run += 1;
+            continue;
+        }
+        n_symbols += rle_flush_run(self, symbols + n_symbols);
+        symbols[n_symbols++] = data[i];
+        self->last = data[i];
+    }
+    return n_symbols;
+}
+
+size_t rle_finish(Rle *self, u_int16_t *symbols)
+{
+    size_t n_symbols = rle_flush_run(self, symbols);
+    symbols[n_symbols++] = RLE_EOB;
+    rle_reset(self);
+    return n_symbols;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <stdlib.h>
+#include <sys/types.h>
+
+// Symbols past the 256 literals: an end-of-block marker, then one symbol
+// per power of two that repeats the previous literal 2^k more times.
+#define RLE_EOB 256
+#define RLE_RUN_SYMBOL 257
+#define RLE_N_RUN_SYMBOLS 48
+#define RLE_N_SYMBOLS (RLE_RUN_SYMBOL + RLE_N_RUN_SYMBOLS)
+// rle_encode emits at most this many symbols more than the bytes it is fed
+#define RLE_MAX_EXTRA_SYMBOLS (RLE_N_RUN_SYMBOLS + 1)
+#define RLE_RUN_LENGTH(symbol) ((size_t)1 << ((symbol) - RLE_RUN_SYMBOL))
+
+typedef struct Rle_s Rle;
+
+Rle *rle_new(void);
+void rle_free(Rle *self);
+void rle_reset(Rle *self);
+size_t rle_encode(Rle *self, const u_int8_t *data, size_t size,
+                  u_int16_t *symbols);
+size_t rle_finish(Rle *self, u_int16_t *symbols);
@@ -0,0 +1,378 @@
+// for ppoll
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "huff.h"
+#include "server.h"
+
+#define SERVER_BACKLOG 64
+// most jobs a worker takes from the queue in one go
+#define SERVER_BATCH_SIZE 16
+
+typedef struct ServerConnection {
+    int fd;
+    // jobs queued or running; the connection is closed once it has hung up
+    // and this drops to zero
+    size_t pending;
+    bool hung_up;
+} ServerConnection;
+
+typedef struct ServerJob {
+    ServerConnection *connection;
+    HuffRequest request;
+    int in_fd;
+    int out_fd;
+    struct ServerJob *next;
+} ServerJob;
+
+typedef struct Server {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    ServerJob *head;
+    ServerJob *tail;
+    size_t n_queued;
+    ServerJob *free_jobs;
+    size_t n_workers;
+    bool stopping;
+    const Kernels *kernels;
+    const HuffPlan *plan;
+    CodeCache *encode_cache;
+    CodeCache *decode_cache;
+} Server;
+
+static volatile sig_atomic_t server_stop = 0;
+
+static void server_on_signal(int signum)
+{
+    (void)signum;
+    server_stop = 1;
+}
+
+// with server->lock held
+static void server_connection_release(ServerConnection *connection)
+{
+    if (connection->hung_up && connection->pending == 0) {
+        close(connection->fd);
+        free(connection);
+    }
+}
+
+// Returns 0, or the errno the job failed with.
+static int server_run_job(HuffWorkspace *ws, ServerJob *job)
+{
+    bool rle = job->request.flags & HUFF_REQUEST_RLE;
+    bool context = job->request.flags & HUFF_REQUEST_CONTEXT;
+    HuffDecodeMode mode = job->request.flags & HUFF_REQUEST_TABLE
+                              ? HUFF_DECODE_TABLE
+                              : HUFF_DECODE_TREE;
+    int status;
+    switch (job->request.command) {
+    case HUFF_REQUEST_ENCODE:
+        status = huff_encode_fd(ws, job->in_fd, job->out_fd, rle, context);
+        break;
+    case HUFF_REQUEST_DECODE:
+        status = huff_decode_fd(ws, job->in_fd, job->out_fd, mode);
+        break;
+    default:
+        status = -1;
+        errno = EINVAL;
+        break;
+    }
+    return status < 0 ? errno : 0;
+}
+
+static void *server_worker(void *data)
+{
+    Server *server = data;
+    HuffWorkspace *ws =
+        huff_workspace_new(server->kernels, server->plan, server->encode_cache,
+                           server->decode_cache);
+    ServerJob *batch[SERVER_BATCH_SIZE];
+
+    for (;;) {
+        pthread_mutex_lock(&server->lock);
+        while (server->head == NULL && !server->stopping) {
+            pthread_cond_wait(&server->ready, &server->lock);
+        }
+        if (server->head == NULL) {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+        // a fair share of the queue, so one worker doesn't sit on jobs
+        // others are idle for
+        size_t n_batch = server->n_queued / server->n_workers;
+        n_batch = n_batch < 1 ? 1 : n_batch;
+        n_batch = n_batch > SERVER_BATCH_SIZE ? SERVER_BATCH_SIZE : n_batch;
+        size_t n_jobs = 0;
+        while (server->head != NULL && n_jobs < n_batch) {
+            batch[n_jobs++] = server->head;
+            server->head = server->head->next;
+            server->n_queued -= 1;
+        }
+        if (server->head == NULL) {
+            server->tail = NULL;
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        for (size_t i = 0; i < n_jobs; i++) {
+            ServerJob *job = batch[i];
+            HuffResponse response = {
+                .id = job->request.id,
+                .status = server_run_job(ws, job),
+            };
+            close(job->in_fd);
+            close(job->out_fd);
+            send(job->connection->fd, &response, sizeof(response),
+                 MSG_NOSIGNAL);
+        }
+
+        pthread_mutex_lock(&server->lock);
+        for (size_t i = 0; i < n_jobs; i++) {
+            ServerJob *job = batch[i];
+            job->connection->pending -= 1;
+            server_connection_release(job->connection);
+            job->next = server->free_jobs;
+            server->free_jobs = job;
+        }
+        pthread_mutex_unlock(&server->lock);
+    }
+
+    huff_workspace_free(ws);
+    return NULL;
+}
+
+// Reads one request and queues it. Returns false once the client has gone
+// away or sent something that isn't a request.
+static bool server_receive(Server *server, ServerConnection *connection)
+{
+    HuffRequest request;
+    int fds[2];
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = {.iov_base = &request, .iov_len = sizeof(request)};
+    struct msghdr message = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control),
+    };
+    ssize_t n = recvmsg(connection->fd, &message, MSG_CMSG_CLOEXEC);
+    if (n < 0 && errno == EINTR) {
+        return true;
+    }
+
+    size_t n_fds = 0;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    if (n > 0 && cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS) {
+        n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds, CMSG_DATA(cmsg), n_fds * sizeof(int));
+    }
+    if (n != sizeof(request) || n_fds != 2) {
+        for (size_t i = 0; i < n_fds; i++) {
+            close(fds[i]);
+        }
+        return false;
+    }
+
+    pthread_mutex_lock(&server->lock);
+    ServerJob *job = server->free_jobs;
+    if (job != NULL) {
+        server->free_jobs = job->next;
+    } else {
+        job = malloc(sizeof(*job));
+    }
+    job->connection = connection;
+    job->request = request;
+    job->in_fd = fds[0];
+    job->out_fd = fds[1];
+    job->next = NULL;
+    if (server->tail != NULL) {
+        server->tail->next = job;
+    } else {
+        server->head = job;
+    }
+    server->tail = job;
+    server->n_queued += 1;
+    connection->pending += 1;
+    pthread_cond_signal(&server->ready);
+    pthread_mutex_unlock(&server->lock);
+    return true;
+}
+
+static int server_listen(char *socket_path)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        return -1;
+    }
+    unlink(socket_path);
+    if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(listen_fd, SERVER_BACKLOG) < 0) {
+        close(listen_fd);
+        return -1;
+    }
+    return listen_fd;
+}
+
+static void server_print_cache_stats(char *name, CodeCache *cache)
+{
+    CodeCacheStats stats = code_cache_stats(cache);
+    fprintf(stderr,
+            "%s tables: %zu hits, %zu misses, %zu replaced, %zu evicted\n",
+            name, stats.hits, stats.misses, stats.replaced, stats.evictions);
+}
+
+// Serves requests until SIGINT or SIGTERM, with the workers, stacks and
+// caches the plan gives. Workers each keep their own HuffWorkspace for the
+// life of the server and share the code table caches (none if the plan has
+// no entries); the calling thread only accepts connections and queues
+// requests. Returns -1 if the server could not start.
+int huff_server_run(char *socket_path, const HuffPlan *plan,
+                    const Kernels *kernels)
+{
+    size_t n_workers = plan->n_workers;
+    size_t n_cache_entries = plan->n_cache_entries;
+    int listen_fd = server_listen(socket_path);
+    if (listen_fd < 0) {
+        perror(socket_path);
+        return -1;
+    }
+
+    // the stop signals are held back everywhere but in ppoll below, so
+    // they neither land on a worker nor slip in before ppoll starts
+    sigset_t stop_signals;
+    sigset_t poll_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &poll_mask);
+    struct sigaction action = {.sa_handler = server_on_signal};
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    Server server = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .ready = PTHREAD_COND_INITIALIZER,
+        .n_workers = n_workers,
+        .kernels = kernels,
+        .plan = plan,
+    };
+    if (n_cache_entries > 0) {
+        server.encode_cache = huff_encode_cache_new(n_cache_entries);
+        server.decode_cache = huff_decode_cache_new(n_cache_entries);
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, plan->stack_size);
+    pthread_t *workers = malloc(sizeof(*workers) * n_workers);
+    size_t n_started = 0;
+    int create_error = 0;
+    while (n_started < n_workers) {
+        create_error = pthread_create(&workers[n_started], &attr,
+                                      server_worker, &server);
+        if (create_error != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(create_error));
+            break;
+        }
+        n_started += 1;
+    }
+    pthread_attr_destroy(&attr);
+
+    size_t capacity = 16;
+    size_t n_fds = 1;
+    struct pollfd *fds = malloc(sizeof(*fds) * capacity);
+    ServerConnection **connections = malloc(sizeof(*connections) * capacity);
+    fds[0] = (struct pollfd){.fd = listen_fd, .events = POLLIN};
+
+    while (create_error == 0 && !server_stop) {
+        if (ppoll(fds, n_fds, NULL, &poll_mask) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("ppoll");
+            break;
+        }
+
+        // from the back, so a connection moved into a closed one's slot
+        // has already been looked at
+        for (size_t i = n_fds - 1; i > 0; i--) {
+            if (fds[i].revents == 0 ||
+                server_receive(&server, connections[i])) {
+                continue;
+            }
+            pthread_mutex_lock(&server.lock);
+            connections[i]->hung_up = true;
+            server_connection_release(connections[i]);
+            pthread_mutex_unlock(&server.lock);
+            n_fds -= 1;
+            fds[i] = fds[n_fds];
+            connections[i] = connections[n_fds];
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd < 0) {
+                continue;
+            }
+            if (n_fds == capacity) {
+                capacity *= 2;
+                fds = realloc(fds, sizeof(*fds) * capacity);
+                connections =
+                    realloc(connections, sizeof(*connections) * capacity);
+            }
+            ServerConnection *connection = malloc(sizeof(*connection));
+            *connection = (ServerConnection){.fd = fd};
+            fds[n_fds] = (struct pollfd){.fd = fd, .events = POLLIN};
+            connections[n_fds] = connection;
+            n_fds += 1;
+        }
+    }
+
+    pthread_mutex_lock(&server.lock);
+    server.stopping = true;
+    pthread_cond_broadcast(&server.ready);
+    pthread_mutex_unlock(&server.lock);
+    for (size_t i = 0; i < n_started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    for (size_t i = 1; i < n_fds; i++) {
+        connections[i]->hung_up = true;
+        server_connection_release(connections[i]);
+    }
+    while (server.free_jobs != NULL) {
+        ServerJob *job = server.free_jobs;
+        server.free_jobs = job->next;
+        free(job);
+    }
+    if (n_cache_entries > 0) {
+        server_print_cache_stats("encode", server.encode_cache);
+        server_print_cache_stats("decode", server.decode_cache);
+        code_cache_free(server.encode_cache);
+        code_cache_free(server.decode_cache);
+    }
+    free(connections);
+    free(fds);
+    free(workers);
+    close(listen_fd);
+    unlink(socket_path);
+    pthread_sigmask(SIG_SETMASK, &poll_mask, NULL);
+    return create_error != 0 ? -1 : 0;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "kernels.h"
+
+typedef struct HuffPlan HuffPlan;
+
+#define HUFF_REQUEST_ENCODE 'e'
+#define HUFF_REQUEST_DECODE 'd'
+#define HUFF_REQUEST_RLE 0x1
+#define HUFF_REQUEST_TABLE 0x2
+#define HUFF_REQUEST_CONTEXT 0x4
+// stack each worker thread gets, and a memory budget counts
+#define HUFF_WORKER_STACK_SIZE (256 * 1024)
+
+// Sent with the input and output descriptors attached (SCM_RIGHTS): the
+// server reads and writes them directly and the data never crosses the
+// socket. Encoding reads its input twice, so it has to be seekable.
+typedef struct HuffRequest {
+    u_int32_t id;
+    u_int8_t command;
+    u_int8_t flags;
+} HuffRequest;
+
+// status is 0, or the errno the request failed with: EINVAL for an encoded
+// input that is cut short or was not written by encode, or whatever reading
+// or writing the descriptors ran into.
+typedef struct HuffResponse {
+    u_int32_t id;
+    int32_t status;
+} HuffResponse;
+
+int huff_server_run(char *socket_path, const HuffPlan *plan,
+                    const Kernels *kernels);
+
+int huff_client_connect(char *socket_path);
+int huff_client_request(int socket_fd, HuffRequest *request, int in_fd,
+                        int out_fd, HuffResponse *response);
@@ -0,0 +1,42 @@
+#pragma once
+// Static probes (USDT, provider "huff") for perf and bpftrace, compiled in
+// with -Dtracing=enabled. Each is a nop plus an ELF note, and arguments
+// that take work to gather are only gathered while a tracer is attached,
+// through the probe's semaphore. Without the option they are not there at
+// all.
+//
+//   histogram_done      symbols, distinct symbols, rle
+//   tree_built          leaves, shortest code, longest code,
+//                       mean code length in 1/1000 bits
+//   header_written      header bytes
+//   payload_flushed     payload bytes, symbols (once per block)
+//   decode_table_built  header bytes, leaves, entries left to the tree walk,
+//                       mean symbols per entry in 1/1000
+//   decode_finished     encoded bytes, decoded bytes, table mode
+//
+// Under -C, tree_built and decode_table_built fire once per context tree,
+// the latter for its KERNEL_CONTEXT_TABLE_BITS table.
+//
+// e.g. bpftrace -e 'usdt:./huff:huff:tree_built { @max = hist(arg2); }'
+#ifdef HUFF_TRACING
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define HUFF_TRACE_SEMAPHORE(name)                                             \
+    unsigned short huff_##name##_semaphore __attribute__((unused))            \
+    __attribute__((section(".probes")))
+#define HUFF_TRACE_ENABLED(name)                                               \
+    __builtin_expect(huff_##name##_semaphore != 0, 0)
+#define HUFF_TRACE1(name, a) STAP_PROBE1(huff, name, a)
+#define HUFF_TRACE2(name, a, b) STAP_PROBE2(huff, name, a, b)
+#define HUFF_TRACE3(name, a, b, c) STAP_PROBE3(huff, name, a, b, c)
+#define HUFF_TRACE4(name, a, b, c, d) STAP_PROBE4(huff, name, a, b, c, d)
+#else
+#define HUFF_TRACE_SEMAPHORE(name) struct huff_##name##_semaphore
+#define HUFF_TRACE_ENABLED(name) 0
+#define HUFF_TRACE1(name, a) ((void)(a))
+#define HUFF_TRACE2(name, a, b) ((void)(a), (void)(b))
+#define HUFF_TRACE3(name, a, b, c) ((void)(a), (void)(b), (void)(c))
+#define HUFF_TRACE4(name, a, b, c, d)                                          \
+    ((void)(a), (void)(b), (void)(c), (void)(d))
+#endif
@@ -0,0 +1,127 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+double bench_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Writes the first size bytes of the corpus, repeated if it is shorter, to
+// path.
+bool bench_write_input(char *corpus_path, char *path, size_t size)
+{
+    FILE *corpus = fopen(corpus_path, "r");
+    FILE *file = fopen(path, "w");
+    unsigned char *buffer = malloc(BENCH_IO_SIZE);
+    bool ok = corpus != NULL && file != NULL;
+    for (size_t written = 0; ok && written < size;) {
+        size_t n = fread(buffer, 1, BENCH_IO_SIZE, corpus);
+        if (n == 0) {
+            ok = written > 0;
+            rewind(corpus);
+            continue;
+        }
+        n = size - written < n ? size - written : n;
+        ok = fwrite(buffer, 1, n, file) == n;
+        written += n;
+    }
+    free(buffer);
+    if (corpus) {
+        fclose(corpus);
+    }
+    if (file) {
+        ok = fclose(file) == 0 && ok;
+    }
+    return ok;
+}
+
+// The decoder pads the last byte with zero bits, which may decode to extra
+// trailing symbols when there is no end-of-block symbol, so the input only
+// has to be a prefix of the output.
+bool bench_is_prefix(char *prefix_path, char *path)
+{
+    FILE *prefix_file = fopen(prefix_path, "r");
+    FILE *file = fopen(path, "r");
+    unsigned char *buffer_a = malloc(BENCH_IO_SIZE);
+    unsigned char *buffer_b = malloc(BENCH_IO_SIZE);
+    bool is_prefix = prefix_file != NULL && file != NULL;
+    size_t n_read;
+    while (is_prefix &&
+           (n_read = fread(buffer_a, 1, BENCH_IO_SIZE, prefix_file)) > 0) {
+        is_prefix = fread(buffer_b, 1, n_read, file) == n_read &&
+                    memcmp(buffer_a, buffer_b, n_read) == 0;
+    }
+    free(buffer_a);
+    free(buffer_b);
+    if (prefix_file) {
+        fclose(prefix_file);
+    }
+    if (file) {
+        fclose(file);
+    }
+    return is_prefix;
+}
+
+// -1 if the file cannot be opened.
+long bench_file_size(char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+// Runs argv[0] with argv and waits for it, leaving how long it took and the
+// most memory it held in *run if run is not NULL. Returns whether it exited
+// with 0.
+bool bench_run(char *argv[], BenchRun *run)
+{
+    double start = bench_now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (pid < 0 || wait4(pid, &status, 0, &usage) != pid) {
+        return false;
+    }
+    if (run != NULL) {
+        run->seconds = bench_now() - start;
+        run->max_rss_kib = usage.ru_maxrss;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Leaves huff encoding in_path to out_path with the options, up to a NULL,
+// in argv, which has room for BENCH_ENCODE_ARGC.
+void bench_encode_argv(char *huff, char *const *options, char *in_path,
+                       char *out_path, char *argv[])
+{
+    size_t n_args = 0;
+    argv[n_args++] = huff;
+    for (size_t i = 0; options[i] != NULL; i++) {
+        argv[n_args++] = options[i];
+    }
+    argv[n_args++] = "encode";
+    argv[n_args++] = in_path;
+    argv[n_args++] = out_path;
+    argv[n_args] = NULL;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define MIB (1024 * 1024)
+// bytes the benchmarks read and write at a time
+#define BENCH_IO_SIZE MIB
+
+// encode options a mode may have, and room for huff, the options, the
+// command, its paths and the NULL in an encode argv
+#define BENCH_MAX_OPTIONS 2
+#define BENCH_ENCODE_ARGC (BENCH_MAX_OPTIONS + 5)
+
+typedef struct BenchRun {
+    double seconds;
+    long max_rss_kib;
+} BenchRun;
+
+typedef struct BenchMode {
+    const char *name;
+    // encode options, up to a NULL
+    char *options[BENCH_MAX_OPTIONS + 1];
+} BenchMode;
+
+// What the benchmarks share: timing, inputs cut from a corpus, checking
+// what huff decoded, and running huff itself.
+double bench_now(void);
+bool bench_write_input(char *corpus_path, char *path, size_t size);
+bool bench_is_prefix(char *prefix_path, char *path);
+long bench_file_size(char *path);
+bool bench_run(char *argv[], BenchRun *run);
+void bench_encode_argv(char *huff, char *const *options, char *in_path,
+                       char *out_path, char *argv[]);
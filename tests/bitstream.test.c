@@ -1,10 +1,13 @@
 #include "../src/bitstream.h"
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 void bitstream_test_write_bit(char *test_file_path)
 {
+    remove(test_file_path);
     BitStreamWriter *bs = bitstream_writer_new(test_file_path);
     bitstream_write_bit(bs, 0x1);
     bitstream_write_bit(bs, 0x0);
@@ -16,6 +19,7 @@ void bitstream_test_write_bit(char *test_file_path)
     assert(c == 0xA0); // 0xA0 == 0b10100000
     fclose(test_file);
 
+    remove(test_file_path);
     bs = bitstream_writer_new(test_file_path);
     bitstream_write_bit(bs, 0x1);
     bitstream_write_bit(bs, 0x0);
@@ -35,6 +39,7 @@ void bitstream_test_write_bit(char *test_file_path)
 
 void bitstream_test_write_data(char *test_file_path)
 {
+    remove(test_file_path);
     BitStreamWriter *bs = bitstream_writer_new(test_file_path);
     bitstream_write_data(bs, 0x555, 16); // 0x555 = 0b10101010101
     bitstream_writer_close(bs, true);
@@ -46,6 +51,7 @@ void bitstream_test_write_data(char *test_file_path)
     assert(c == 0x55); // 0x555 = 0b01010101
     fclose(test_file);
 
+    remove(test_file_path);
     bs = bitstream_writer_new(test_file_path);
     bitstream_write_data(bs, 0x2796, 18); // 0x2796 = 0b000010011110010110
     bitstream_writer_close(bs, true);
@@ -59,6 +65,7 @@ void bitstream_test_write_data(char *test_file_path)
     assert(c == 0x80); // 0x80 = 0b10000000
     fclose(test_file);
 
+    remove(test_file_path);
     bs = bitstream_writer_new(test_file_path);
     bitstream_write_data(bs, 0x2796, 18); // 0x2796 = 0b000010011110010110
     bitstream_writer_close(bs, true);
@@ -73,6 +80,28 @@ void bitstream_test_write_data(char *test_file_path)
     fclose(test_file);
 }
 
+void bitstream_test_write_bytes(char *test_file_path)
+{
+    const u_int8_t bytes[] = {0xAB, 0xCD};
+    remove(test_file_path);
+    BitStreamWriter *bs = bitstream_writer_new(test_file_path);
+    bitstream_write_bytes(bs, bytes, 2);
+    bitstream_write_bit(bs, 0x1);
+    bitstream_write_bytes(bs, bytes, 1);
+    bitstream_writer_close(bs, true);
+
+    FILE *test_file = fopen(test_file_path, "r"); // ab cd 1|1010101|1
+    u_int8_t c = fgetc(test_file);
+    assert(c == 0xAB);
+    c = fgetc(test_file);
+    assert(c == 0xCD);
+    c = fgetc(test_file);
+    assert(c == 0xD5); // 0xD5 = 0b11010101
+    c = fgetc(test_file);
+    assert(c == 0x80); // 0x80 = 0b10000000
+    fclose(test_file);
+}
+
 void bitstream_test_read_bit(char *test_file_path)
 {
     FILE *test_file = fopen(test_file_path, "w");
@@ -119,10 +148,55 @@ void bitstream_test_read_bit(char *test_file_path)
     assert(b < 0);
 }
 
+void bitstream_test_buffer_size(char *test_file_path)
+{
+    // a buffer smaller than what goes through it at once, so writes and
+    // reads span several flushes and refills
+    u_int8_t bytes[10];
+    for (int i = 0; i < 10; i++) {
+        bytes[i] = i * 37;
+    }
+    int fd = open(test_file_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    BitStreamWriter *writer = bitstream_writer_new_full(fd, 3);
+    bitstream_write_bit(writer, 0x1);
+    bitstream_write_bytes(writer, bytes, 10);
+    bitstream_writer_close(writer, true);
+
+    fd = open(test_file_path, O_RDONLY);
+    BitStreamReader *reader = bitstream_reader_new_full(fd, 3);
+    assert(bitstream_read_bit(reader) == 1);
+    for (int i = 0; i < 10; i++) {
+        u_int8_t c = 0;
+        for (int j = 0; j < 8; j++) {
+            c = c << 1 | bitstream_read_bit(reader);
+        }
+        assert(c == bytes[i]);
+    }
+    for (int j = 0; j < 7; j++) {
+        assert(bitstream_read_bit(reader) == 0);
+    }
+    assert(bitstream_read_bit(reader) < 0);
+    assert(bitstream_reader_close(reader) == 0);
+}
+
+void bitstream_test_write_error(char *test_file_path)
+{
+    // writes to a descriptor opened for reading fail, and closing says so
+    int fd = open(test_file_path, O_RDONLY);
+    BitStreamWriter *writer = bitstream_writer_new_full(fd, 3);
+    bitstream_write_bytes(writer, (u_int8_t *)"abcdef", 6);
+    errno = 0;
+    assert(bitstream_writer_close(writer, true) < 0);
+    assert(errno == EBADF);
+}
+
 int main()
 {
     char *test_file_path = "bitstream-test.bin";
     bitstream_test_write_bit(test_file_path);
     bitstream_test_write_data(test_file_path);
+    bitstream_test_write_bytes(test_file_path);
     bitstream_test_read_bit(test_file_path);
+    bitstream_test_buffer_size(test_file_path);
+    bitstream_test_write_error(test_file_path);
 }
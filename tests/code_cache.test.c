@@ -0,0 +1,124 @@
+#include "../src/code_cache.h"
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+
+#define N_THREADS 4
+#define N_THREAD_ROUNDS 10000
+
+static size_t n_freed = 0;
+
+void code_cache_test_free(void *value)
+{
+    n_freed += 1;
+    free(value);
+}
+
+int *code_cache_test_value(int n)
+{
+    int *value = malloc(sizeof(*value));
+    *value = n;
+    return value;
+}
+
+void code_cache_test_lru(void)
+{
+    n_freed = 0;
+    CodeCache *cache = code_cache_new(2, code_cache_test_free);
+    assert(code_cache_get(cache, "a", 1) == NULL);
+    code_cache_release(cache,
+                       code_cache_put(cache, "a", 1, code_cache_test_value(1)));
+    code_cache_release(cache,
+                       code_cache_put(cache, "b", 1, code_cache_test_value(2)));
+
+    // using "a" makes "b" the one to go
+    CodeCacheEntry *entry = code_cache_get(cache, "a", 1);
+    assert(*(int *)code_cache_value(entry) == 1);
+    code_cache_release(cache, entry);
+    code_cache_release(cache,
+                       code_cache_put(cache, "c", 1, code_cache_test_value(3)));
+    assert(n_freed == 1);
+    assert(code_cache_get(cache, "b", 1) == NULL);
+    entry = code_cache_get(cache, "a", 1);
+    assert(entry != NULL);
+    code_cache_release(cache, entry);
+
+    // keys are compared whole, not only by prefix
+    assert(code_cache_get(cache, "ab", 2) == NULL);
+
+    CodeCacheStats stats = code_cache_stats(cache);
+    assert(stats.hits == 2);
+    assert(stats.misses == 3);
+    assert(stats.evictions == 1);
+    code_cache_free(cache);
+    assert(n_freed == 3);
+}
+
+void code_cache_test_refs(void)
+{
+    n_freed = 0;
+    CodeCache *cache = code_cache_new(1, code_cache_test_free);
+    CodeCacheEntry *held =
+        code_cache_put(cache, "a", 1, code_cache_test_value(1));
+
+    // replaced while held: the old value lives until it is released
+    CodeCacheEntry *replacement =
+        code_cache_put(cache, "a", 1, code_cache_test_value(2));
+    assert(n_freed == 0);
+    assert(*(int *)code_cache_value(held) == 1);
+    code_cache_release(cache, held);
+    assert(n_freed == 1);
+    held = code_cache_get(cache, "a", 1);
+    assert(held == replacement);
+    assert(*(int *)code_cache_value(held) == 2);
+    code_cache_release(cache, replacement);
+
+    // and the same once evicted
+    code_cache_release(cache,
+                       code_cache_put(cache, "b", 1, code_cache_test_value(3)));
+    assert(n_freed == 1);
+    code_cache_release(cache, held);
+    assert(n_freed == 2);
+    assert(code_cache_stats(cache).replaced == 1);
+    code_cache_free(cache);
+    assert(n_freed == 3);
+}
+
+void *code_cache_test_thread(void *data)
+{
+    CodeCache *cache = data;
+    for (int i = 0; i < N_THREAD_ROUNDS; i++) {
+        char key = 'a' + i % 8;
+        CodeCacheEntry *entry = code_cache_get(cache, &key, 1);
+        if (entry == NULL) {
+            int *value = malloc(sizeof(*value));
+            *value = key;
+            entry = code_cache_put(cache, &key, 1, value);
+        }
+        assert(*(int *)code_cache_value(entry) == key);
+        code_cache_release(cache, entry);
+    }
+    return NULL;
+}
+
+void code_cache_test_threads(void)
+{
+    CodeCache *cache = code_cache_new(4, free);
+    pthread_t threads[N_THREADS];
+    for (int i = 0; i < N_THREADS; i++) {
+        pthread_create(&threads[i], NULL, code_cache_test_thread, cache);
+    }
+    for (int i = 0; i < N_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    CodeCacheStats stats = code_cache_stats(cache);
+    assert(stats.hits + stats.misses == N_THREADS * N_THREAD_ROUNDS);
+    code_cache_free(cache);
+}
+
+int main()
+{
+    code_cache_test_lru();
+    code_cache_test_refs();
+    code_cache_test_threads();
+}
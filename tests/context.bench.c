@@ -0,0 +1,116 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define BENCH_DEFAULT_MIB 16
+#define BENCH_DEFAULT_RUNS 5
+
+typedef struct BenchResult {
+    size_t size;
+    double encode_seconds;
+    double decode_seconds;
+} BenchResult;
+
+static const BenchMode BENCH_MODES[] = {
+    {"one tree", {NULL}},
+    {"context", {"-C", NULL}},
+    {"rle", {"-r", NULL}},
+    {"rle context", {"-r", "-C", NULL}},
+};
+#define N_BENCH_MODES (sizeof(BENCH_MODES) / sizeof(*BENCH_MODES))
+
+// The fastest of n_runs runs of argv, or a negative time if one fails.
+double bench_best_of(char *argv[], size_t n_runs)
+{
+    double best = -1;
+    for (size_t i = 0; i < n_runs; i++) {
+        BenchRun run;
+        if (!bench_run(argv, &run)) {
+            return -1;
+        }
+        best = best < 0 || run.seconds < best ? run.seconds : best;
+    }
+    return best;
+}
+
+bool bench_mode(char *huff, const BenchMode *mode, char *in_path,
+                char *huff_path, char *out_path, size_t n_runs,
+                BenchResult *result)
+{
+    char *encode_argv[BENCH_ENCODE_ARGC];
+    bench_encode_argv(huff, mode->options, in_path, huff_path, encode_argv);
+    char *decode_argv[] = {huff,      "-D",     "table", "decode",
+                           huff_path, out_path, NULL};
+
+    result->encode_seconds = bench_best_of(encode_argv, n_runs);
+    result->decode_seconds = bench_best_of(decode_argv, n_runs);
+    if (result->encode_seconds < 0 || result->decode_seconds < 0 ||
+        !bench_is_prefix(in_path, out_path)) {
+        fprintf(stderr, "%s: could not round-trip %s\n", mode->name,
+                in_path);
+        return false;
+    }
+    result->size = bench_file_size(huff_path);
+    return true;
+}
+
+// Compares each mode against the one before it: order-1 coding against one
+// tree, with and without run-length encoding.
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <huff> <corpus> [MiB] [runs] [work dir]\n",
+                argv[0]);
+        return 1;
+    }
+    char *huff = argv[1];
+    size_t mib = argc > 3 ? strtoull(argv[3], NULL, 10) : BENCH_DEFAULT_MIB;
+    size_t n_runs = argc > 4 ? strtoull(argv[4], NULL, 10)
+                             : BENCH_DEFAULT_RUNS;
+    char *dir = argc > 5 ? argv[5] : ".";
+    if (mib == 0 || n_runs == 0) {
+        fprintf(stderr, "MiB and runs must be positive\n");
+        return 1;
+    }
+
+    char in_path[4096], huff_path[4096], out_path[4096];
+    snprintf(in_path, sizeof(in_path), "%s/context.in", dir);
+    snprintf(huff_path, sizeof(huff_path), "%s/context.huff", dir);
+    snprintf(out_path, sizeof(out_path), "%s/context.out", dir);
+    if (!bench_write_input(argv[2], in_path, mib * MIB)) {
+        fprintf(stderr, "could not write %s\n", in_path);
+        return 1;
+    }
+
+    printf("%12s %12s %8s %12s %12s\n", "mode", "bytes", "ratio",
+           "enc MiB/s", "dec MiB/s");
+    BenchResult results[N_BENCH_MODES];
+    bool ok = true;
+    for (size_t i = 0; i < N_BENCH_MODES && ok; i++) {
+        ok = bench_mode(huff, &BENCH_MODES[i], in_path, huff_path, out_path,
+                        n_runs, &results[i]);
+        if (!ok) {
+            break;
+        }
+        printf("%12s %12zu %8.3f %12.1f %12.1f\n", BENCH_MODES[i].name,
+               results[i].size, (double)results[i].size / (mib * MIB),
+               mib / results[i].encode_seconds,
+               mib / results[i].decode_seconds);
+        if (i % 2 == 1) {
+            BenchResult *base = &results[i - 1];
+            printf("%12s %11.1f%% %8s %11.1f%% %11.1f%%\n", "change",
+                   100.0 * ((double)results[i].size / base->size - 1), "",
+                   100.0 * (base->encode_seconds / results[i].encode_seconds -
+                            1),
+                   100.0 * (base->decode_seconds / results[i].decode_seconds -
+                            1));
+        }
+        fflush(stdout);
+    }
+    remove(in_path);
+    remove(huff_path);
+    remove(out_path);
+    return ok ? 0 : 1;
+}
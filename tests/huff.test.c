@@ -0,0 +1,216 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+#define TEST_IN "huff-test.in"
+#define TEST_HUFF "huff-test.huff"
+#define TEST_OUT "huff-test.out"
+
+static const BenchMode TEST_MODES[] = {
+    {"default", {NULL}},
+    {"rle", {"-r", NULL}},
+    {"context", {"-C", NULL}},
+    {"rle context", {"-r", "-C", NULL}},
+};
+#define N_TEST_MODES (sizeof(TEST_MODES) / sizeof(*TEST_MODES))
+
+// Files encoded in the original tree format have no end-of-block symbol,
+// and may decode to as many extra symbols as the last byte has padding
+// bits; the rest give back exactly the input.
+bool test_decoded(char *in_path, char *encoded_path, char *out_path)
+{
+    FILE *encoded = fopen(encoded_path, "r");
+    int tag = encoded ? fgetc(encoded) : EOF;
+    if (encoded) {
+        fclose(encoded);
+    }
+    long extra = bench_file_size(out_path) - bench_file_size(in_path);
+    if (tag == '\0') {
+        return extra >= 0 && extra < 8 && bench_is_prefix(in_path, out_path);
+    }
+    return extra == 0 && bench_is_prefix(in_path, out_path);
+}
+
+void test_write(const u_int8_t *data, size_t size)
+{
+    FILE *file = fopen(TEST_IN, "w");
+    assert(file != NULL);
+    assert(fwrite(data, 1, size, file) == size);
+    fclose(file);
+}
+
+// Encodes TEST_IN in every mode and decodes it with the tree and the table.
+void test_round_trips(char *huff, const char *input)
+{
+    for (size_t i = 0; i < N_TEST_MODES; i++) {
+        char *encode_argv[BENCH_ENCODE_ARGC];
+        bench_encode_argv(huff, TEST_MODES[i].options, TEST_IN, TEST_HUFF,
+                          encode_argv);
+        assert(bench_run(encode_argv, NULL));
+
+        char *decoders[] = {"tree", "table"};
+        for (size_t j = 0; j < 2; j++) {
+            char *decode_argv[] = {huff,      "-D",     decoders[j], "decode",
+                                   TEST_HUFF, TEST_OUT, NULL};
+            bool ok = bench_run(decode_argv, NULL) &&
+                      test_decoded(TEST_IN, TEST_HUFF, TEST_OUT);
+            if (!ok) {
+                fprintf(stderr, "%s: %s with the %s did not round-trip\n",
+                        input, TEST_MODES[i].name, decoders[j]);
+            }
+            assert(ok);
+        }
+    }
+}
+
+// Runs of zeros long enough to need the largest run symbols and to span
+// several output blocks, between a few other bytes.
+void test_sparse(char *huff)
+{
+    size_t size = 0;
+    u_int8_t *data = malloc(8 * 1024 * 1024);
+    size_t runs[] = {1, 2, 3, 255, 256, 70000, 1 << 20, 3 * 1000 * 1000};
+    for (size_t i = 0; i < sizeof(runs) / sizeof(*runs); i++) {
+        memset(data + size, 0, runs[i]);
+        size += runs[i];
+        data[size++] = 1 + i;
+        data[size++] = 0xff;
+    }
+    test_write(data, size);
+    free(data);
+    test_round_trips(huff, "sparse");
+}
+
+// Every byte, after every byte.
+void test_all_bytes(char *huff)
+{
+    u_int8_t *data = malloc(256 * 256 * 2);
+    size_t size = 0;
+    for (size_t a = 0; a < 256; a++) {
+        for (size_t b = 0; b < 256; b++) {
+            data[size++] = a;
+            data[size++] = b;
+        }
+    }
+    test_write(data, size);
+    free(data);
+    test_round_trips(huff, "all bytes");
+}
+
+// Bytes as /dev/urandom gives them, with every value and no runs to speak
+// of.
+void test_random(char *huff)
+{
+    size_t size = 100 * 1000;
+    u_int8_t *data = malloc(size);
+    u_int64_t state = 0x9E3779B97F4A7C15;
+    for (size_t i = 0; i < size; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        data[i] = state >> 56;
+    }
+    test_write(data, size);
+    free(data);
+    test_round_trips(huff, "random");
+}
+
+void test_text(char *huff, char *corpus_path)
+{
+    assert(bench_write_input(corpus_path, TEST_IN, 2 * MIB));
+    test_round_trips(huff, "text");
+}
+
+// Inputs whose trees come out with a single symbol, which the encoder pads
+// with a second leaf or an end of block, or that have hardly any symbols
+// at all.
+void test_small(char *huff)
+{
+    u_int8_t alternating[1000];
+    for (size_t i = 0; i < sizeof(alternating); i++) {
+        alternating[i] = i % 2 ? 'b' : 'a';
+    }
+    test_write(alternating, sizeof(alternating));
+    test_round_trips(huff, "alternating");
+    test_write((u_int8_t *)"x", 1);
+    test_round_trips(huff, "one byte");
+    test_write((u_int8_t *)"aaaa", 4);
+    test_round_trips(huff, "one symbol");
+    // lone symbols that are also the tags of the wide and context formats
+    test_write((u_int8_t *)"WWWW", 4);
+    test_round_trips(huff, "W tag");
+    test_write((u_int8_t *)"CCCC", 4);
+    test_round_trips(huff, "C tag");
+    test_write((u_int8_t *)"", 0);
+    test_round_trips(huff, "empty");
+}
+
+// Headers decoding has to turn down rather than build tables from.
+void test_bad_headers(char *huff)
+{
+    // an untagged lone leaf, which could be read forever
+    u_int8_t lone_leaf[] = {'a', 0};
+    // a leaf past the alphabet
+    u_int8_t bad_symbol[] = {'W', 0x00, 0x01, 0xff, 0xff, 0x01, 0x00, 'a', 0};
+    // codes longer than 32 bits, down a branch with a leaf on each left
+    u_int8_t too_deep[1 + 34 * 4 + 3 + 1] = {'W'};
+    size_t size = 1;
+    for (size_t i = 0; i < 34; i++) {
+        u_int8_t link[] = {0x00, 0x01, 0x00, i};
+        memcpy(too_deep + size, link, sizeof(link));
+        size += sizeof(link);
+    }
+    memcpy(too_deep + size, (u_int8_t[]){0x01, 0x00, 'a'}, 3);
+    // a tree per context and a context mapped past them
+    u_int8_t bad_map[2 + 256 + 7 + 1] = {'C', 1};
+    bad_map[2 + 'q'] = 1;
+    memcpy(bad_map + 2 + 256, (u_int8_t[]){0, 1, 0, 'a', 1, 1, 0}, 7);
+
+    struct {
+        const char *name;
+        u_int8_t *data;
+        size_t size;
+    } headers[] = {
+        {"lone leaf", lone_leaf, sizeof(lone_leaf)},
+        {"bad symbol", bad_symbol, sizeof(bad_symbol)},
+        {"too deep", too_deep, sizeof(too_deep)},
+        {"bad map", bad_map, sizeof(bad_map)},
+        {"cut short", bad_map, 2 + 100},
+    };
+    for (size_t i = 0; i < sizeof(headers) / sizeof(*headers); i++) {
+        FILE *file = fopen(TEST_HUFF, "w");
+        fwrite(headers[i].data, 1, headers[i].size, file);
+        fclose(file);
+        char *decoders[] = {"tree", "table"};
+        for (size_t j = 0; j < 2; j++) {
+            char *decode_argv[] = {huff,      "-D",     decoders[j], "decode",
+                                   TEST_HUFF, TEST_OUT, NULL};
+            if (bench_run(decode_argv, NULL)) {
+                fprintf(stderr, "%s: decoded with the %s\n", headers[i].name,
+                        decoders[j]);
+                assert(false);
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <huff> <text corpus>\n", argv[0]);
+        return 1;
+    }
+    test_sparse(argv[1]);
+    test_all_bytes(argv[1]);
+    test_random(argv[1]);
+    test_text(argv[1], argv[2]);
+    test_small(argv[1]);
+    test_bad_headers(argv[1]);
+    remove(TEST_IN);
+    remove(TEST_HUFF);
+    remove(TEST_OUT);
+}
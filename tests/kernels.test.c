@@ -0,0 +1,180 @@
+#include "../src/h_tree.h"
+#include "../src/kernels.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N_TEST_SYMBOLS 10000
+#define N_LEAVES 20
+// past the byte range, like the run-length symbols
+#define WIDE_SYMBOL 300
+
+static const char *KERNEL_NAMES[] = {"scalar", "avx2"};
+
+// A chain-shaped tree: codes run from 1 to N_LEAVES - 1 bits, so decoding
+// goes through both the table and the long-code walk.
+HuffmanNode *kernels_test_tree(HuffmanNode **leaves)
+{
+    leaves[0] = h_leaf_new(WIDE_SYMBOL, 1);
+    HuffmanNode *tree = leaves[0];
+    for (int i = 1; i < N_LEAVES; i++) {
+        leaves[i] = h_leaf_new(i, 1);
+        tree = h_branch_new(leaves[i], tree);
+    }
+    return tree;
+}
+
+// The same chain the other way round, so the symbols with short codes in
+// one tree have long ones in the other.
+HuffmanNode *kernels_test_reversed_tree(HuffmanNode **leaves)
+{
+    leaves[N_LEAVES - 1] = h_leaf_new(N_LEAVES - 1, 1);
+    HuffmanNode *tree = leaves[N_LEAVES - 1];
+    for (int i = N_LEAVES - 2; i >= 0; i--) {
+        leaves[i] = h_leaf_new(i == 0 ? WIDE_SYMBOL : i, 1);
+        tree = h_branch_new(leaves[i], tree);
+    }
+    return tree;
+}
+
+void kernels_test_symbols(u_int16_t *symbols, int *leaf_symbols)
+{
+    size_t state = 42;
+    for (size_t i = 0; i < N_TEST_SYMBOLS; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        // favour the short codes, as real data does
+        size_t leaf = __builtin_ctzll(state | (size_t)1 << (N_LEAVES - 1));
+        symbols[i] = leaf_symbols[N_LEAVES - 1 - leaf];
+    }
+}
+
+void kernels_test_histogram(const Kernels *kernels, u_int16_t *symbols)
+{
+    size_t expected[KERNEL_MAX_SYMBOLS] = {0};
+    size_t counts[KERNEL_MAX_SYMBOLS] = {0};
+    for (size_t i = 0; i < N_TEST_SYMBOLS; i++) {
+        expected[symbols[i]] += 1;
+    }
+    // counts add up across calls
+    kernels->histogram(symbols, 7, counts, KERNEL_MAX_SYMBOLS);
+    kernels->histogram(symbols + 7, N_TEST_SYMBOLS - 7, counts,
+                       KERNEL_MAX_SYMBOLS);
+    assert(memcmp(counts, expected, sizeof(counts)) == 0);
+}
+
+void kernels_test_pack_decode(const Kernels *kernels, HuffmanNode *tree,
+                              HuffmanNode **leaves, u_int16_t *symbols)
+{
+    KernelCode codes[KERNEL_MAX_SYMBOLS] = {{0}};
+    for (int i = 0; i < N_LEAVES; i++) {
+        HuffmanCode code = h_tree_bubble(leaves[i], (HuffmanCode){0});
+        int symbol = i == 0 ? WIDE_SYMBOL : i;
+        codes[symbol] = (KernelCode){code.data, code.offset};
+    }
+
+    u_int8_t packed[N_TEST_SYMBOLS * 4 + 8] = {0};
+    KernelPacker packer = {0};
+    size_t size = kernels->pack(&packer, codes, symbols, 13, packed);
+    size += kernels->pack(&packer, codes, symbols + 13, N_TEST_SYMBOLS - 13,
+                          packed + size);
+    for (; packer.n_bits >= 8; packer.n_bits -= 8) {
+        packed[size++] = packer.bits >> (packer.n_bits - 8);
+    }
+    if (packer.n_bits > 0) {
+        packed[size++] = packer.bits << (8 - packer.n_bits);
+    }
+
+    KernelDecodeTable *table = h_table_new(tree);
+    u_int16_t decoded[N_TEST_SYMBOLS + 8];
+    KernelBits bits = {.data = packed, .n_bits = size * 8};
+    size_t n_decoded = kernels->decode(table, &bits, false, decoded,
+                                       N_TEST_SYMBOLS + 8);
+    n_decoded += kernels->decode(table, &bits, true, decoded + n_decoded,
+                                 N_TEST_SYMBOLS + 8 - n_decoded);
+    h_table_free(table);
+
+    // the zero padding may decode to a few more symbols
+    assert(n_decoded >= N_TEST_SYMBOLS);
+    assert(memcmp(decoded, symbols, sizeof(*symbols) * N_TEST_SYMBOLS) == 0);
+}
+
+// Odd bytes pick the reversed tree, so the table changes from one code to
+// the next all the time; the wide symbol keeps the one before it.
+void kernels_test_pack_decode_context(const Kernels *kernels,
+                                      HuffmanNode **trees,
+                                      HuffmanNode *leaves[][N_LEAVES],
+                                      u_int16_t *symbols)
+{
+    u_int8_t map[KERNEL_N_LITERALS];
+    for (int i = 0; i < KERNEL_N_LITERALS; i++) {
+        map[i] = i % 2;
+    }
+    static KernelCode codes[2][KERNEL_MAX_SYMBOLS];
+    for (int t = 0; t < 2; t++) {
+        for (int i = 0; i < N_LEAVES; i++) {
+            HuffmanCode code = h_tree_bubble(leaves[t][i], (HuffmanCode){0});
+            int symbol = i == 0 ? WIDE_SYMBOL : i;
+            codes[t][symbol] = (KernelCode){code.data, code.offset};
+        }
+    }
+
+    u_int8_t packed[N_TEST_SYMBOLS * 4 + 8] = {0};
+    KernelPacker packer = {0};
+    size_t size = kernels->pack_context(&packer, map, *codes,
+                                        KERNEL_MAX_SYMBOLS, symbols, 13,
+                                        packed);
+    size += kernels->pack_context(&packer, map, *codes, KERNEL_MAX_SYMBOLS,
+                                  symbols + 13, N_TEST_SYMBOLS - 13,
+                                  packed + size);
+    for (; packer.n_bits >= 8; packer.n_bits -= 8) {
+        packed[size++] = packer.bits >> (packer.n_bits - 8);
+    }
+    if (packer.n_bits > 0) {
+        packed[size++] = packer.bits << (8 - packer.n_bits);
+    }
+
+    KernelContextTables *tables = malloc(sizeof(*tables));
+    h_context_tables_build(tables, trees, 2, map);
+    u_int16_t decoded[N_TEST_SYMBOLS + 8];
+    KernelBits bits = {.data = packed, .n_bits = size * 8};
+    size_t n_decoded = kernels->decode_context(tables, &bits, false, decoded,
+                                               N_TEST_SYMBOLS + 8);
+    n_decoded += kernels->decode_context(tables, &bits, true,
+                                         decoded + n_decoded,
+                                         N_TEST_SYMBOLS + 8 - n_decoded);
+    free(tables);
+
+    assert(n_decoded >= N_TEST_SYMBOLS);
+    assert(memcmp(decoded, symbols, sizeof(*symbols) * N_TEST_SYMBOLS) == 0);
+}
+
+int main()
+{
+    HuffmanNode *leaves[2][N_LEAVES];
+    HuffmanNode *trees[2] = {kernels_test_tree(leaves[0]),
+                             kernels_test_reversed_tree(leaves[1])};
+    HuffmanNode *tree = trees[0];
+    int leaf_symbols[N_LEAVES];
+    leaf_symbols[0] = WIDE_SYMBOL;
+    for (int i = 1; i < N_LEAVES; i++) {
+        leaf_symbols[i] = i;
+    }
+    u_int16_t symbols[N_TEST_SYMBOLS];
+    kernels_test_symbols(symbols, leaf_symbols);
+
+    assert(kernels_get("scalar") != NULL);
+    assert(kernels_get("no such kernels") == NULL);
+    for (size_t i = 0; i < sizeof(KERNEL_NAMES) / sizeof(*KERNEL_NAMES); i++) {
+        const Kernels *kernels = kernels_get(KERNEL_NAMES[i]);
+        if (kernels == NULL) {
+            continue;
+        }
+        kernels_test_histogram(kernels, symbols);
+        kernels_test_pack_decode(kernels, tree, leaves[0], symbols);
+        kernels_test_pack_decode_context(kernels, trees, leaves, symbols);
+    }
+    h_node_free(trees[0]);
+    h_node_free(trees[1]);
+}
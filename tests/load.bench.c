@@ -0,0 +1,180 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../src/server.h"
+#include "bench.h"
+
+#define BENCH_DEFAULT_CLIENTS 4
+#define BENCH_DEFAULT_REQUESTS 2000
+#define BENCH_DEFAULT_SIZE 4096
+#define BENCH_CONNECT_TRIES 100
+
+typedef struct BenchClient {
+    pthread_t thread;
+    char *socket_path;
+    char *in_path;
+    char *huff_path;
+    size_t n_requests;
+    double *latencies;
+    bool ok;
+} BenchClient;
+
+int bench_compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Alternates encode and table decode requests, each with fresh output.
+void *bench_client(void *data)
+{
+    BenchClient *client = data;
+    int socket_fd = huff_client_connect(client->socket_path);
+    int in_fd = open(client->in_path, O_RDONLY);
+    int huff_fd = open(client->huff_path, O_RDONLY);
+    FILE *out = tmpfile();
+    client->ok = socket_fd >= 0 && in_fd >= 0 && huff_fd >= 0 && out != NULL;
+
+    for (size_t i = 0; client->ok && i < client->n_requests; i++) {
+        bool encode = i % 2 == 0;
+        HuffRequest request = {
+            .id = i,
+            .command = encode ? HUFF_REQUEST_ENCODE : HUFF_REQUEST_DECODE,
+            .flags = encode ? 0 : HUFF_REQUEST_TABLE,
+        };
+        int request_fd = encode ? in_fd : huff_fd;
+        lseek(request_fd, 0, SEEK_SET);
+        lseek(fileno(out), 0, SEEK_SET);
+        if (ftruncate(fileno(out), 0) < 0) {
+            client->ok = false;
+            break;
+        }
+
+        HuffResponse response;
+        double start = bench_now();
+        client->ok = huff_client_request(socket_fd, &request, request_fd,
+                                         fileno(out), &response) == 0 &&
+                     response.id == request.id && response.status == 0;
+        client->latencies[i] = bench_now() - start;
+    }
+
+    if (socket_fd >= 0) {
+        close(socket_fd);
+    }
+    if (in_fd >= 0) {
+        close(in_fd);
+    }
+    if (huff_fd >= 0) {
+        close(huff_fd);
+    }
+    if (out) {
+        fclose(out);
+    }
+    return NULL;
+}
+
+int bench_connect(char *socket_path)
+{
+    for (int i = 0; i < BENCH_CONNECT_TRIES; i++) {
+        int socket_fd = huff_client_connect(socket_path);
+        if (socket_fd >= 0) {
+            return socket_fd;
+        }
+        usleep(10000);
+    }
+    return -1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        fprintf(stderr,
+                "usage: %s <huff> <corpus> [clients] [requests] [size]\n",
+                argv[0]);
+        return 1;
+    }
+    char *huff = argv[1];
+    size_t n_clients = argc > 3 ? strtoull(argv[3], NULL, 10)
+                                : BENCH_DEFAULT_CLIENTS;
+    size_t n_requests = argc > 4 ? strtoull(argv[4], NULL, 10)
+                                 : BENCH_DEFAULT_REQUESTS;
+    size_t size = argc > 5 ? strtoull(argv[5], NULL, 10) : BENCH_DEFAULT_SIZE;
+    if (n_clients == 0 || n_requests == 0 || size == 0) {
+        fprintf(stderr, "clients, requests and size must be positive\n");
+        return 1;
+    }
+
+    char socket_path[64], in_path[64], huff_path[64];
+    snprintf(socket_path, sizeof(socket_path), "/tmp/huff-load-%d.sock",
+             getpid());
+    snprintf(in_path, sizeof(in_path), "/tmp/huff-load-%d.in", getpid());
+    snprintf(huff_path, sizeof(huff_path), "/tmp/huff-load-%d.huff",
+             getpid());
+    char *encode_argv[] = {huff, "encode", in_path, huff_path, NULL};
+    if (!bench_write_input(argv[2], in_path, size) ||
+        !bench_run(encode_argv, NULL)) {
+        fprintf(stderr, "could not prepare the input\n");
+        return 1;
+    }
+
+    pid_t server = fork();
+    if (server == 0) {
+        execl(huff, huff, "serve", socket_path, (char *)NULL);
+        _exit(127);
+    }
+    int probe_fd = bench_connect(socket_path);
+    if (probe_fd < 0) {
+        fprintf(stderr, "could not connect to %s\n", socket_path);
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+        return 1;
+    }
+    close(probe_fd);
+
+    BenchClient *clients = calloc(n_clients, sizeof(*clients));
+    double *latencies = malloc(sizeof(*latencies) * n_clients * n_requests);
+    double start = bench_now();
+    for (size_t i = 0; i < n_clients; i++) {
+        clients[i] = (BenchClient){
+            .socket_path = socket_path,
+            .in_path = in_path,
+            .huff_path = huff_path,
+            .n_requests = n_requests,
+            .latencies = latencies + i * n_requests,
+        };
+        pthread_create(&clients[i].thread, NULL, bench_client, &clients[i]);
+    }
+    bool ok = true;
+    for (size_t i = 0; i < n_clients; i++) {
+        pthread_join(clients[i].thread, NULL);
+        ok = ok && clients[i].ok;
+    }
+    double seconds = bench_now() - start;
+
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    remove(in_path);
+    remove(huff_path);
+
+    if (ok) {
+        size_t n = n_clients * n_requests;
+        qsort(latencies, n, sizeof(*latencies), bench_compare_doubles);
+        printf("%8s %8s %10s %12s %10s %10s\n", "clients", "size",
+               "requests", "requests/s", "p50 us", "p99 us");
+        printf("%8zu %8zu %10zu %12.0f %10.1f %10.1f\n", n_clients, size, n,
+               n / seconds, latencies[n / 2] * 1e6,
+               latencies[n * 99 / 100] * 1e6);
+    } else {
+        fprintf(stderr, "a request failed\n");
+    }
+    free(latencies);
+    free(clients);
+    return ok ? 0 : 1;
+}
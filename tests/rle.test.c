@@ -0,0 +1,75 @@
+#include "../src/rle.h"
+#include <assert.h>
+#include <string.h>
+
+void rle_test_literals(void)
+{
+    Rle *rle = rle_new();
+    u_int16_t symbols[16 + RLE_MAX_EXTRA_SYMBOLS];
+    const u_int8_t data[] = {'a', 'b', 'b', 'c', 'c', 'c', 'c'};
+    size_t n = rle_encode(rle, data, sizeof(data), symbols);
+    n += rle_finish(rle, symbols + n);
+
+    // runs shorter than four repeats stay literals
+    const u_int16_t expected[] = {'a', 'b', 'b', 'c', 'c', 'c', 'c', RLE_EOB};
+    assert(n == sizeof(expected) / sizeof(*expected));
+    assert(memcmp(symbols, expected, sizeof(expected)) == 0);
+    rle_free(rle);
+}
+
+void rle_test_runs(void)
+{
+    Rle *rle = rle_new();
+    u_int16_t symbols[64 + RLE_MAX_EXTRA_SYMBOLS];
+    u_int8_t data[64];
+    memset(data, 0, sizeof(data));
+    data[63] = 'x';
+
+    // 0 followed by 62 more zeros: 62 = 0b111110
+    size_t n = rle_encode(rle, data, 40, symbols);
+    assert(n == 1);
+    n += rle_encode(rle, data + 40, 24, symbols + n);
+    n += rle_finish(rle, symbols + n);
+
+    const u_int16_t expected[] = {0,
+                                  RLE_RUN_SYMBOL + 5,
+                                  RLE_RUN_SYMBOL + 4,
+                                  RLE_RUN_SYMBOL + 3,
+                                  RLE_RUN_SYMBOL + 2,
+                                  RLE_RUN_SYMBOL + 1,
+                                  'x',
+                                  RLE_EOB};
+    assert(n == sizeof(expected) / sizeof(*expected));
+    assert(memcmp(symbols, expected, sizeof(expected)) == 0);
+
+    size_t run = 0;
+    for (size_t i = 1; i < 6; i++) {
+        run += RLE_RUN_LENGTH(symbols[i]);
+    }
+    assert(run == 62);
+    rle_free(rle);
+}
+
+// An input abandoned partway leaves nothing behind for the next one.
+void rle_test_reset(void)
+{
+    Rle *rle = rle_new();
+    u_int16_t symbols[16 + RLE_MAX_EXTRA_SYMBOLS];
+    const u_int8_t data[] = {'a', 'a', 'a', 'a', 'a', 'a'};
+    rle_encode(rle, data, sizeof(data), symbols);
+    rle_reset(rle);
+
+    size_t n = rle_encode(rle, data, 1, symbols);
+    n += rle_finish(rle, symbols + n);
+    const u_int16_t expected[] = {'a', RLE_EOB};
+    assert(n == sizeof(expected) / sizeof(*expected));
+    assert(memcmp(symbols, expected, sizeof(expected)) == 0);
+    rle_free(rle);
+}
+
+int main()
+{
+    rle_test_literals();
+    rle_test_runs();
+    rle_test_reset();
+}
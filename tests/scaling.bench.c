@@ -0,0 +1,98 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define BENCH_DEFAULT_MAX_MIB 16384
+#define BENCH_STEPS 5
+
+size_t xorshift64(size_t *state)
+{
+    size_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+// Geometric byte distribution: byte k has probability 2^-(k + 1), so the
+// most common one, 0x00, passes 2^31 occurrences from 4 GiB on and the
+// rare tail pushes the code lengths past HUFF_MAX_CODE_LENGTH.
+bool bench_generate(char *path, size_t size)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+    unsigned char *buffer = malloc(BENCH_IO_SIZE);
+    size_t state = 0x9E3779B97F4A7C15;
+    for (size_t written = 0; written < size; written += BENCH_IO_SIZE) {
+        size_t n = size - written < BENCH_IO_SIZE ? size - written
+                                                  : BENCH_IO_SIZE;
+        for (size_t i = 0; i < n; i++) {
+            size_t r = xorshift64(&state) | (size_t)1 << 40;
+            buffer[i] = __builtin_ctzll(r);
+        }
+        fwrite(buffer, 1, n, file);
+    }
+    free(buffer);
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <huff> [max MiB] [work dir]\n", argv[0]);
+        return 1;
+    }
+    char *huff = argv[1];
+    size_t max_mib = argc > 2 ? strtoull(argv[2], NULL, 10)
+                              : BENCH_DEFAULT_MAX_MIB;
+    char *dir = argc > 3 ? argv[3] : ".";
+
+    char in_path[4096], huff_path[4096], out_path[4096];
+    snprintf(in_path, sizeof(in_path), "%s/scaling.in", dir);
+    snprintf(huff_path, sizeof(huff_path), "%s/scaling.huff", dir);
+    snprintf(out_path, sizeof(out_path), "%s/scaling.out", dir);
+
+    printf("%10s %12s %12s %12s %12s %8s\n", "MiB", "enc MiB/s",
+           "enc RSS KiB", "dec MiB/s", "dec RSS KiB", "ratio");
+    bool ok = true;
+    for (int step = BENCH_STEPS - 1; step >= 0 && ok; step--) {
+        size_t mib = max_mib >> step;
+        if (mib == 0) {
+            continue;
+        }
+        if (!bench_generate(in_path, mib * MIB)) {
+            fprintf(stderr, "could not write %s\n", in_path);
+            return 1;
+        }
+
+        BenchRun encode, decode;
+        char *encode_argv[] = {huff, "encode", in_path, huff_path, NULL};
+        char *decode_argv[] = {huff, "-D", "table", "decode", huff_path,
+                               out_path, NULL};
+        ok = bench_run(encode_argv, &encode) && bench_run(decode_argv, &decode);
+        if (ok && !bench_is_prefix(in_path, out_path)) {
+            fprintf(stderr, "%zu MiB: decoded output does not match\n", mib);
+            ok = false;
+        }
+        if (!ok) {
+            break;
+        }
+
+        double ratio = (double)bench_file_size(huff_path) / (mib * MIB);
+
+        printf("%10zu %12.1f %12ld %12.1f %12ld %8.3f\n", mib,
+               mib / encode.seconds, encode.max_rss_kib, mib / decode.seconds,
+               decode.max_rss_kib, ratio);
+        fflush(stdout);
+        remove(in_path);
+        remove(huff_path);
+        remove(out_path);
+    }
+    return ok ? 0 : 1;
+}